@@ -0,0 +1,156 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "arena.h"
+
+/* the huge page size of x86-64 and arm64 */
+#define HUGE_SIZE ((size_t)2 << 20)
+
+static arena_pages_t default_pages = PAGES_SMALL;
+static const char *file_dir = NULL;
+
+static const char *page_name[PAGES_COUNT] = { "small", "thp", "huge" };
+
+/* map -H argument to pages, return 0 if unknown */
+int parse_pages(const char *name, arena_pages_t *pages) {
+    int i;
+    for (i = 0; i < PAGES_COUNT; i++) {
+        if (strcmp(name, page_name[i]) == 0) {
+            *pages = (arena_pages_t)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const char *pages_name(arena_pages_t pages) {
+    return page_name[pages];
+}
+
+void set_arena_pages(arena_pages_t pages) {
+    default_pages = pages;
+}
+
+void set_arena_dir(const char *dir) {
+    file_dir = dir;
+}
+
+static size_t round_up(size_t n, size_t to) {
+    return (n + to - 1) / to * to;
+}
+
+// map a sparse file of size bytes in file_dir, the file is unlinked at
+// once so it goes away with the mapping, its holes read as zero
+static char *map_file(size_t size) {
+    char *path = (char*)malloc(strlen(file_dir) + 16);
+    char *base = (char*)MAP_FAILED;
+    int fd;
+    sprintf(path, "%s/light-XXXXXX", file_dir);
+    fd = mkstemp(path);
+    if (fd == -1) {
+        fprintf(stderr, "Couldn't create a file in %s\n", file_dir);
+        free(path);
+        return (char*)MAP_FAILED;
+    }
+    unlink(path);
+    free(path);
+    if (ftruncate(fd, size) == 0)
+        base = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return base;
+}
+
+arena_t *new_arena(size_t size) {
+    arena_t *a = (arena_t*)calloc(1, sizeof(arena_t));
+    if (a == NULL)
+        return NULL;
+    size = size > 0 ? size : 1;
+    a->pages = default_pages;
+    a->base = (char*)MAP_FAILED;
+    if (file_dir != NULL) {
+        // page cache pages, -H does not apply
+        a->pages = PAGES_SMALL;
+        a->file = 1;
+        a->mapped = round_up(size, sysconf(_SC_PAGESIZE));
+        a->base = map_file(a->mapped);
+        if (a->base == MAP_FAILED) {
+            free(a);
+            return NULL;
+        }
+    }
+#ifdef MAP_HUGETLB
+    if (a->pages == PAGES_HUGE) {
+        a->mapped = round_up(size, HUGE_SIZE);
+        a->base = (char*)mmap(NULL, a->mapped, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (a->base == MAP_FAILED) {
+            fprintf(stderr, "No huge pages for %zu bytes, using small pages\n", a->mapped);
+            a->pages = PAGES_SMALL;
+        }
+    }
+#else
+    a->pages = a->pages == PAGES_HUGE ? PAGES_SMALL : a->pages;
+#endif
+    if (a->base == MAP_FAILED) {
+        // thp only backs the 2 MB aligned part, map one more to align it
+        a->mapped = a->pages == PAGES_THP ? round_up(size, HUGE_SIZE) + HUGE_SIZE : size;
+        a->base = (char*)mmap(NULL, a->mapped, PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (a->base == MAP_FAILED) {
+        free(a);
+        return NULL;
+    }
+    a->start = a->base;
+    a->size = a->mapped;
+#ifdef MADV_HUGEPAGE
+    if (a->pages == PAGES_THP) {
+        a->start = (char*)round_up((uintptr_t)a->base, HUGE_SIZE);
+        a->size = a->mapped - (a->start - a->base);
+        madvise(a->start, a->size, MADV_HUGEPAGE);
+    }
+#else
+    a->pages = a->pages == PAGES_THP ? PAGES_SMALL : a->pages;
+#endif
+    a->used = 0;
+    return a;
+}
+
+void free_arena(arena_t *a) {
+    if (a == NULL)
+        return;
+    munmap(a->base, a->mapped);
+    free(a);
+}
+
+void *arena_alloc_at(arena_t *a, size_t n, size_t offset) {
+    // the pages of a fresh mapping are zero and nothing is handed out twice
+    size_t pad = (ARENA_ALIGN - (a->used + offset) % ARENA_ALIGN) % ARENA_ALIGN;
+    char *p;
+    if (a->used + pad + n > a->size)
+        return NULL;
+    p = a->start + a->used + pad;
+    a->used = round_up(a->used + pad + n, ARENA_ALIGN);
+    return p;
+}
+
+void *arena_alloc(arena_t *a, size_t n) {
+    return arena_alloc_at(a, n, 0);
+}
+
+void arena_advise(arena_t *a, void *p, size_t n, arena_advice_t advice) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    char *start, *end;
+    // dropping the pages of an anonymous mapping would zero them
+    if (!a->file || p == NULL || n == 0)
+        return;
+    start = (char*)((uintptr_t)p / page * page);
+    end = (char*)round_up((uintptr_t)p + n, page);
+    madvise(start, end - start, advice == ARENA_WILLNEED ? MADV_WILLNEED : MADV_DONTNEED);
+}
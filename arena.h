@@ -0,0 +1,58 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+#include <stddef.h>
+
+/*
+ One mapping that hands out the grid buffers of a graph, a zone or a
+ multigrid hierarchy. Every buffer starts on an ARENA_ALIGN boundary
+ and is zeroed, they are all released at once by free_arena.
+ The pages backing new arenas are picked with -H:
+   small    the default pages of the system
+   thp      transparent huge pages, advised with madvise
+   huge     explicit huge pages (MAP_HUGETLB), small pages if none
+            are reserved
+ With -D DIR new arenas map an unlinked sparse file in DIR instead,
+ the kernel pages the buffers in and out of it, so a graph larger
+ than the memory runs at the speed of the disk. Sweeps stream through
+ such an arena with arena_advise.
+*/
+
+#define ARENA_ALIGN 64
+
+typedef enum { PAGES_SMALL, PAGES_THP, PAGES_HUGE, PAGES_COUNT } arena_pages_t;
+
+typedef enum { ARENA_WILLNEED, ARENA_DONTNEED } arena_advice_t;
+
+typedef struct {
+    char *base; // start of the mapping
+    size_t mapped; // bytes mapped at base
+    char *start; // first buffer
+    size_t size; // bytes that can be handed out from start
+    size_t used;
+    arena_pages_t pages; // the pages it got
+    int file; // backed by a file of the -D directory
+} arena_t;
+
+// bytes an arena needs for a buffer of n bytes, padding included
+static inline size_t arena_span(size_t n) {
+    return (n + 2 * ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+int parse_pages(const char *name, arena_pages_t *pages);
+const char *pages_name(arena_pages_t pages);
+// pages of the arenas made from now on
+void set_arena_pages(arena_pages_t pages);
+// back the arenas made from now on by files in dir, NULL for memory
+void set_arena_dir(const char *dir);
+
+arena_t *new_arena(size_t size);
+void free_arena(arena_t *a);
+// n zeroed bytes, aligned, NULL once the arena is full
+void *arena_alloc(arena_t *a, size_t n);
+// n zeroed bytes whose byte offset is aligned
+void *arena_alloc_at(arena_t *a, size_t n, size_t offset);
+// the n bytes at p are read soon or not for a while, only file backed
+// arenas take the hint, their dropped pages are read back from the file
+void arena_advise(arena_t *a, void *p, size_t n, arena_advice_t advice);
+
+#endif
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <math.h>
+#include "graph.h"
+#include "stencil.h"
+#include "cycletimer.h"
+
+/*
+ Throughput of the jacobi row kernels on a synthetic field.
+ Every kernel the cpu supports runs the same number of sweeps from the
+ same start, the result is compared against the scalar kernel.
+ The field is stored and swept in the chosen layout like sim-seq does.
+*/
+
+static void usage(char *name) {
+    char *use_string = "[-x WIDTH] [-y HEIGHT] [-r SWEEPS] [-L LAYOUT]";
+    fprintf(stdout, "Usage: %s %s\n", name, use_string);
+    fprintf(stdout, "   -h        Print this message\n");
+    fprintf(stdout, "   -x WIDTH  Width of the field\n");
+    fprintf(stdout, "   -y HEIGHT Height of the field\n");
+    fprintf(stdout, "   -r SWEEPS Number of sweeps per kernel\n");
+    fprintf(stdout, "   -L LAYOUT Cell storage order (row|tile)\n");
+    exit(0);
+}
+
+// run `sweeps` sweeps of kernel on a copy of init, returns the field
+static real_t *run(stencil_row_t kernel, graph_t *g, const real_t *init, const real_t *boundary,
+                   const real_t *dirichlet, int sweeps, double *seconds) {
+    idx_t size = graph_cells(g);
+    int n = cell_run(g);
+    real_t *cur = new_field(g->arena, g->height, g->width);
+    real_t *next = new_field(g->arena, g->height, g->width);
+    real_t *tmp;
+    double start;
+    int s, i, j;
+    idx_t idx;
+
+    memcpy(cur, init, (size_t)size * sizeof(real_t));
+    start = currentSeconds();
+    for (s = 0; s < sweeps; s++) {
+        for (idx = 0; idx < size; idx += n) {
+            i = cell_row(g, idx);
+            j = cell_col(g, idx);
+            kernel(i > 0 ? cur + cell_index(g, i - 1, j) : cur - n, cur + idx,
+                   i < g->height - 1 ? cur + cell_index(g, i + 1, j) : cur + size,
+                   boundary + idx, dirichlet + idx, next + idx, n,
+                   j > 0 ? cur[cell_index(g, i, j - 1)] : 0.0,
+                   j + n < g->width ? cur[cell_index(g, i, j + n)] : 0.0);
+        }
+        tmp = cur;
+        cur = next;
+        next = tmp;
+    }
+    *seconds = currentSeconds() - start;
+    return cur;
+}
+
+int main(int argc, char *argv[]) {
+    graph_t g;
+    int width = 1024;
+    int height = 1024;
+    int sweeps = 100;
+    layout_t layout = LAYOUT_ROW;
+    size_t size, k;
+    real_t *init, *boundary, *dirichlet;
+    real_t *ref = NULL;
+    int isa;
+    char c;
+
+    while ((c = getopt(argc, argv, "hx:y:r:L:")) != -1) {
+        switch(c) {
+        case 'x':
+            width = atoi(optarg);
+            break;
+        case 'y':
+            height = atoi(optarg);
+            break;
+        case 'r':
+            sweeps = atoi(optarg);
+            break;
+        case 'L':
+            if (!parse_layout(optarg, &layout))
+                usage(argv[0]);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (width <= 0 || height <= 0 || sweeps <= 0)
+        usage(argv[0]);
+    if (layout == LAYOUT_TILE && (width % LAYOUT_TILE_SIDE != 0 || height % LAYOUT_TILE_SIDE != 0)) {
+        fprintf(stdout, "Sides must be multiples of %d for this layout\n", LAYOUT_TILE_SIDE);
+        exit(1);
+    }
+    g.width = width;
+    g.height = height;
+    g.layout = layout;
+    // the two fields of every kernel
+    g.arena = new_arena(2 * STENCIL_COUNT * arena_span((size_t)(height + 2) * width * sizeof(real_t)));
+
+    // a few percent of bolt cells of both signs, the rest free
+    size = (size_t)width * height;
+    init = (real_t*)malloc(size * sizeof(real_t));
+    boundary = (real_t*)malloc(size * sizeof(real_t));
+    dirichlet = (real_t*)malloc(size * sizeof(real_t));
+    srand(1);
+    for (k = 0; k < size; k++) {
+        int r = rand() % 100;
+        dirichlet[k] = dirichlet_value(r == 0 ? -1 : r < 4 ? 1 : 0);
+        boundary[k] = r == 1 ? 0.0002 : 0.0;
+        init[k] = (double)rand() / RAND_MAX;
+    }
+
+    for (isa = 0; isa < STENCIL_COUNT; isa++) {
+        stencil_row_t kernel = stencil_kernel((stencil_isa_t)isa);
+        double seconds, diff = 0.0;
+        real_t *field;
+        if (kernel == NULL) {
+            fprintf(stdout, "%-8s not supported\n", stencil_name((stencil_isa_t)isa));
+            continue;
+        }
+        field = run(kernel, &g, init, boundary, dirichlet, sweeps, &seconds);
+        if (ref == NULL) {
+            ref = field;
+        } else {
+            for (k = 0; k < size; k++)
+                diff = fmax(diff, fabs(field[k] - ref[k]));
+        }
+        fprintf(stdout, "%-8s %8.3f s %10.3f Mcells/s max diff %g\n", stencil_name((stencil_isa_t)isa),
+                seconds, (double)size * sweeps / seconds * 1e-6, diff);
+    }
+
+    free_arena(g.arena);
+    free(init);
+    free(boundary);
+    free(dirichlet);
+    return 0;
+}
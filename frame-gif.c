@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include "frame.h"
+
+/*
+ Renders the frames a simulator wrote, text or bin, as an animated
+ gif, what -f gif would have written.
+ Frames are read and coded one row at a time, only one row is held in
+ memory.
+*/
+
+static void usage(char *name) {
+    char *use_string = "-i FFILE [-o OFILE]";
+    fprintf(stdout, "Usage: %s %s\n", name, use_string);
+    fprintf(stdout, "   -h        Print this message\n");
+    fprintf(stdout, "   -i FFILE  Frames written with -f text or -f bin\n");
+    fprintf(stdout, "   -o OFILE  Gif file, stdout if not given\n");
+    exit(0);
+}
+
+static int read_text_row(FILE *infile, int *row, int width) {
+    int j;
+    for (j = 0; j < width; j++) {
+        if (fscanf(infile, "%d", &row[j]) != 1)
+            return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    FILE *infile = NULL;
+    FILE *ofile = stdout;
+    gif_writer_t *w;
+    bin_reader_t r;
+    format_t format;
+    int height, width, count;
+    int *row;
+    int64_t idx = 0;
+    int bolt = 0;
+    int more = 0;
+    int c, f, i, j;
+
+    char *optstring = "hi:o:";
+    while ((c = getopt(argc, argv, optstring)) != -1) {
+        switch(c) {
+        case 'h':
+            usage(argv[0]);
+            break;
+        case 'i':
+            infile = fopen(optarg, "rb");
+            break;
+        case 'o':
+            ofile = fopen(optarg, "wb");
+            break;
+        default:
+            fprintf(stdout, "Unknown option '%c'\n", c);
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (infile == NULL) {
+        fprintf(stdout, "Couldn't open frame file\n");
+        exit(1);
+    }
+    // a text header starts with a digit
+    c = getc(infile);
+    ungetc(c, infile);
+    format = c == FRAME_MAGIC[0] ? FORMAT_BIN : FORMAT_TEXT;
+    if (format == FORMAT_BIN && !read_bin_header(infile, &height, &width, &count)) {
+        fprintf(stderr, "Not a bin frame file\n");
+        exit(1);
+    }
+    if (format == FORMAT_TEXT && fscanf(infile, "%d %d %d", &height, &width, &count) != 3) {
+        fprintf(stderr, "Not a text frame file\n");
+        exit(1);
+    }
+
+    write_header(ofile, FORMAT_GIF, height, width, count);
+    w = (gif_writer_t*)malloc(sizeof(gif_writer_t));
+    row = (int*)calloc(width, sizeof(int));
+    for (f = 0; f < count; f++) {
+        gif_frame_begin(w, ofile, height, width);
+        if (format == FORMAT_BIN) {
+            bin_frame_open(&r, infile);
+            more = bin_frame_next(&r, &idx, &bolt);
+        }
+        for (i = 0; i < height; i++) {
+            if (format == FORMAT_TEXT) {
+                if (!read_text_row(infile, row, width)) {
+                    fprintf(stderr, "Frame %d is truncated\n", f);
+                    exit(1);
+                }
+                gif_frame_row(w, row, width);
+                continue;
+            }
+            for (j = 0; j < width; j++) {
+                row[j] = 0;
+            }
+            while (more == 1 && idx < (int64_t)(i + 1) * width) {
+                row[idx - (int64_t)i * width] = bolt;
+                more = bin_frame_next(&r, &idx, &bolt);
+            }
+            gif_frame_row(w, row, width);
+        }
+        gif_frame_end(w);
+        if (format == FORMAT_BIN && more != 0) {
+            fprintf(stderr, "Frame %d is %s\n", f, more == -1 ? "truncated" : "larger than the graph");
+            exit(1);
+        }
+    }
+    write_trailer(ofile, FORMAT_GIF);
+    free(row);
+    free(w);
+    fclose(infile);
+    fclose(ofile);
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include "graph.h"
+#include "frame.h"
+
+/*
+ Turns the frames a simulator wrote with -f bin back into the text
+ format, byte for byte what -f text would have written.
+ Rows are filled from the sparse cells one at a time, only one row is
+ held in memory.
+*/
+
+static void usage(char *name) {
+    char *use_string = "-i BFILE [-o OFILE]";
+    fprintf(stdout, "Usage: %s %s\n", name, use_string);
+    fprintf(stdout, "   -h        Print this message\n");
+    fprintf(stdout, "   -i BFILE  Frames written with -f bin\n");
+    fprintf(stdout, "   -o OFILE  Text frames, stdout if not given\n");
+    exit(0);
+}
+
+int main(int argc, char *argv[]) {
+    FILE *infile = NULL;
+    FILE *ofile = stdout;
+    bin_reader_t r;
+    int height, width, count;
+    int *row;
+    int64_t idx = 0;
+    int bolt = 0;
+    int more, f, i, j;
+
+    int c;
+    char *optstring = "hi:o:";
+    while ((c = getopt(argc, argv, optstring)) != -1) {
+        switch(c) {
+        case 'h':
+            usage(argv[0]);
+            break;
+        case 'i':
+            infile = fopen(optarg, "rb");
+            break;
+        case 'o':
+            ofile = fopen(optarg, "w");
+            break;
+        default:
+            fprintf(stdout, "Unknown option '%c'\n", c);
+            usage(argv[0]);
+            exit(1);
+        }
+    }
+    if (infile == NULL) {
+        fprintf(stdout, "Couldn't open frame file\n");
+        exit(1);
+    }
+    if (!read_bin_header(infile, &height, &width, &count)) {
+        fprintf(stderr, "Not a bin frame file\n");
+        exit(1);
+    }
+
+    write_header(ofile, FORMAT_TEXT, height, width, count);
+    row = (int*)calloc(width, sizeof(int));
+    for (f = 0; f < count; f++) {
+        bin_frame_open(&r, infile);
+        more = bin_frame_next(&r, &idx, &bolt);
+        for (i = 0; i < height; i++) {
+            for (j = 0; j < width; j++) {
+                row[j] = 0;
+            }
+            while (more == 1 && idx < (int64_t)(i + 1) * width) {
+                row[idx - (int64_t)i * width] = bolt;
+                more = bin_frame_next(&r, &idx, &bolt);
+            }
+            print_row(row, width, ofile);
+        }
+        fprintf(ofile, "\n");
+        if (more != 0) {
+            fprintf(stderr, "Frame %d is %s\n", f, more == -1 ? "truncated" : "larger than the graph");
+            exit(1);
+        }
+    }
+    free(row);
+    fclose(infile);
+    fclose(ofile);
+    return 0;
+}
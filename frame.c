@@ -0,0 +1,274 @@
+#include <stdlib.h>
+#include <string.h>
+#include "frame.h"
+
+static const char *format_names[FORMAT_COUNT] = { "text", "bin", "gif" };
+
+/* map -f argument to format, return 0 if unknown */
+int parse_format(const char *name, format_t *format) {
+    int i;
+    for (i = 0; i < FORMAT_COUNT; i++) {
+        if (strcmp(name, format_names[i]) == 0) {
+            *format = (format_t)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+const char *format_name(format_t format) {
+    return format_names[format];
+}
+
+static void put_u32(FILE *outfile, uint32_t v) {
+    putc(v & 0xff, outfile);
+    putc((v >> 8) & 0xff, outfile);
+    putc((v >> 16) & 0xff, outfile);
+    putc((v >> 24) & 0xff, outfile);
+}
+
+static void put_u16(FILE *outfile, int v) {
+    putc(v & 0xff, outfile);
+    putc((v >> 8) & 0xff, outfile);
+}
+
+static int get_u32(FILE *infile, uint32_t *v) {
+    int k, c;
+    *v = 0;
+    for (k = 0; k < 4; k++) {
+        if ((c = getc(infile)) == EOF)
+            return 0;
+        *v |= (uint32_t)c << (8 * k);
+    }
+    return 1;
+}
+
+// 7 bits per byte, low bits first, the high bit marks more bytes
+static void put_varint(FILE *outfile, uint64_t v) {
+    while (v >= 0x80) {
+        putc((int)(v & 0x7f) | 0x80, outfile);
+        v >>= 7;
+    }
+    putc((int)v, outfile);
+}
+
+static int get_varint(FILE *infile, uint64_t *v) {
+    int shift, c;
+    *v = 0;
+    for (shift = 0; shift < 64; shift += 7) {
+        if ((c = getc(infile)) == EOF)
+            return 0;
+        *v |= (uint64_t)(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return 1;
+    }
+    return 0;
+}
+
+// screen, the gray palette, gray k is color k, and a looping
+// animation
+static void write_gif_header(FILE *outfile, int height, int width) {
+    int k;
+    if (height > GIF_MAX_SIDE || width > GIF_MAX_SIDE) {
+        fprintf(stderr, "A gif is at most %d cells on a side\n", GIF_MAX_SIDE);
+        exit(1);
+    }
+    fwrite("GIF89a", 1, 6, outfile);
+    put_u16(outfile, width);
+    put_u16(outfile, height);
+    putc(0xf7, outfile); // global palette of 256 colors
+    putc(0, outfile);
+    putc(0, outfile);
+    for (k = 0; k < 256; k++) {
+        putc(k, outfile);
+        putc(k, outfile);
+        putc(k, outfile);
+    }
+    putc(0x21, outfile);
+    putc(0xff, outfile);
+    putc(11, outfile);
+    fwrite("NETSCAPE2.0", 1, 11, outfile);
+    putc(3, outfile);
+    putc(1, outfile);
+    put_u16(outfile, 0); // loop forever
+    putc(0, outfile);
+}
+
+void write_header(FILE *outfile, format_t format, int height, int width, int count) {
+    if (format == FORMAT_TEXT) {
+        fprintf(outfile, "%d %d %d\n", height, width, count);
+        return;
+    }
+    if (format == FORMAT_GIF) {
+        write_gif_header(outfile, height, width);
+        return;
+    }
+    fwrite(FRAME_MAGIC, 1, 4, outfile);
+    put_u32(outfile, (uint32_t)height);
+    put_u32(outfile, (uint32_t)width);
+    put_u32(outfile, (uint32_t)count);
+}
+
+void write_trailer(FILE *outfile, format_t format) {
+    if (format == FORMAT_GIF)
+        putc(0x3b, outfile);
+}
+
+int read_bin_header(FILE *infile, int *height, int *width, int *count) {
+    char magic[4];
+    uint32_t h, w, n;
+    if (fread(magic, 1, 4, infile) != 4 || memcmp(magic, FRAME_MAGIC, 4) != 0)
+        return 0;
+    if (!get_u32(infile, &h) || !get_u32(infile, &w) || !get_u32(infile, &n))
+        return 0;
+    *height = (int)h;
+    *width = (int)w;
+    *count = (int)n;
+    return 1;
+}
+
+void bin_frame_begin(bin_writer_t *w, FILE *outfile) {
+    w->outfile = outfile;
+    w->next = 0;
+}
+
+void bin_frame_cell(bin_writer_t *w, int64_t idx, int bolt) {
+    // zigzag: 0, -1, 1, -2 ... become 0, 1, 2, 3 ...
+    uint32_t zz = ((uint32_t)bolt << 1) ^ (uint32_t)(bolt < 0 ? -1 : 0);
+    put_varint(w->outfile, (uint64_t)(idx - w->next));
+    put_varint(w->outfile, zz);
+    w->next = idx + 1;
+}
+
+void bin_frame_end(bin_writer_t *w) {
+    put_varint(w->outfile, 0);
+    put_varint(w->outfile, 0);
+}
+
+void bin_frame_open(bin_reader_t *r, FILE *infile) {
+    r->infile = infile;
+    r->next = 0;
+}
+
+int bin_frame_next(bin_reader_t *r, int64_t *idx, int *bolt) {
+    uint64_t gap, zz;
+    if (!get_varint(r->infile, &gap) || !get_varint(r->infile, &zz))
+        return -1;
+    if (zz == 0)
+        return 0;
+    *idx = r->next + (int64_t)gap;
+    *bolt = (int)((uint32_t)(zz >> 1) ^ -(uint32_t)(zz & 1));
+    r->next = *idx + 1;
+    return 1;
+}
+
+#define GIF_CLEAR 256
+#define GIF_END 257
+#define GIF_MAX_CODE 4095
+
+// gray of a cell, the old genGif.py mapping clamped to the palette
+static int gif_gray(int bolt) {
+    int l;
+    if (bolt <= 0)
+        return 0;
+    l = (int)((bolt - 0.5) * 0.5 * 128);
+    return l < 255 ? l : 255;
+}
+
+static void gif_put_code(gif_writer_t *w, int code) {
+    w->bits |= (uint32_t)code << w->nbits;
+    w->nbits += w->size;
+    while (w->nbits >= 8) {
+        w->block[w->used++] = w->bits & 0xff;
+        w->bits >>= 8;
+        w->nbits -= 8;
+        if (w->used == 255) {
+            putc(255, w->outfile);
+            fwrite(w->block, 1, 255, w->outfile);
+            w->used = 0;
+        }
+    }
+}
+
+static void gif_clear(gif_writer_t *w) {
+    gif_put_code(w, GIF_CLEAR);
+    memset(w->key, 0, sizeof(w->key));
+    w->size = 9;
+    w->max_code = GIF_END;
+}
+
+void gif_frame_begin(gif_writer_t *w, FILE *outfile, int height, int width) {
+    w->outfile = outfile;
+    // graphic control: the delay of the frame
+    putc(0x21, outfile);
+    putc(0xf9, outfile);
+    putc(4, outfile);
+    putc(0, outfile);
+    put_u16(outfile, GIF_DELAY);
+    putc(0, outfile);
+    putc(0, outfile);
+    // image: the whole screen, the global palette
+    putc(0x2c, outfile);
+    put_u16(outfile, 0);
+    put_u16(outfile, 0);
+    put_u16(outfile, width);
+    put_u16(outfile, height);
+    putc(0, outfile);
+    putc(8, outfile); // bits per pixel
+    w->used = 0;
+    w->bits = 0;
+    w->nbits = 0;
+    w->size = 9;
+    w->prefix = -1;
+    gif_clear(w);
+}
+
+void gif_frame_row(gif_writer_t *w, const int *bolt, int width) {
+    int j;
+    for (j = 0; j < width; j++) {
+        int pixel = gif_gray(bolt[j]);
+        int32_t key;
+        int h;
+        if (w->prefix == -1) {
+            w->prefix = pixel;
+            continue;
+        }
+        // open addressing with a secondary hash, as compress does
+        key = 1 + (w->prefix << 8 | pixel);
+        h = (pixel << 4 ^ w->prefix) % GIF_HASH;
+        while (w->key[h] != 0 && w->key[h] != key) {
+            h -= 1 + (w->prefix % (GIF_HASH - 2));
+            if (h < 0)
+                h += GIF_HASH;
+        }
+        if (w->key[h] == key) {
+            w->prefix = w->code[h];
+            continue;
+        }
+        gif_put_code(w, w->prefix);
+        w->key[h] = key;
+        w->code[h] = ++w->max_code;
+        if (w->max_code >= 1 << w->size)
+            w->size++;
+        if (w->max_code == GIF_MAX_CODE)
+            gif_clear(w);
+        w->prefix = pixel;
+    }
+}
+
+void gif_frame_end(gif_writer_t *w) {
+    if (w->prefix != -1) {
+        gif_put_code(w, w->prefix);
+        // the decoder adds a code for it, and may widen the codes
+        if (w->max_code != GIF_END && ++w->max_code >= 1 << w->size)
+            w->size++;
+    }
+    gif_put_code(w, GIF_END);
+    if (w->nbits > 0)
+        w->block[w->used++] = w->bits & 0xff;
+    if (w->used > 0) {
+        putc(w->used, w->outfile);
+        fwrite(w->block, 1, w->used, w->outfile);
+    }
+    putc(0, w->outfile);
+}
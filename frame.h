@@ -0,0 +1,80 @@
+#ifndef __FRAME_H__
+#define __FRAME_H__
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ Output formats of the frames, picked with -f:
+   text     "height width count", then per frame one line of bolt
+            values per row and an empty line
+   bin      FRAME_MAGIC and height, width, count as 32 bit little
+            endian, then per frame the cells of non-zero bolt in row
+            order, each as the varint gap to the previous one and the
+            zigzag varint bolt, closed by a cell of bolt 0
+   gif      an animated GIF, GIF_DELAY hundredths of a second per
+            frame, looping. Bolt cells are gray, brighter the more
+            charge went through them, the rest is black
+ The gaps are row order indices, whatever the layout of the cells.
+ frame-text turns a bin file back into text, frame-gif turns text or
+ bin frames into a GIF.
+*/
+
+#define FRAME_MAGIC "LBF1"
+
+typedef enum { FORMAT_TEXT, FORMAT_BIN, FORMAT_GIF, FORMAT_COUNT } format_t;
+
+int parse_format(const char *name, format_t *format);
+const char *format_name(format_t format);
+
+void write_header(FILE *outfile, format_t format, int height, int width, int count);
+// after the last frame
+void write_trailer(FILE *outfile, format_t format);
+// returns 0 if infile is no bin file
+int read_bin_header(FILE *infile, int *height, int *width, int *count);
+
+// a bin frame being written, cells go in with increasing index
+typedef struct {
+    FILE *outfile;
+    int64_t next; // index right after the last cell
+} bin_writer_t;
+
+void bin_frame_begin(bin_writer_t *w, FILE *outfile);
+void bin_frame_cell(bin_writer_t *w, int64_t idx, int bolt);
+void bin_frame_end(bin_writer_t *w);
+
+// reads the cells of a bin frame back, one at a time
+typedef struct {
+    FILE *infile;
+    int64_t next;
+} bin_reader_t;
+
+void bin_frame_open(bin_reader_t *r, FILE *infile);
+// next cell of the frame, returns 0 at the end of the frame, -1 on
+// a truncated file
+int bin_frame_next(bin_reader_t *r, int64_t *idx, int *bolt);
+
+#define GIF_DELAY 50
+#define GIF_MAX_SIDE 65535
+// entries of the hash table of the LZW codes, a prime above 4096
+#define GIF_HASH 5003
+
+// a gif frame being written, the rows go in top to bottom and are
+// LZW coded as they come, nothing of the frame is kept
+typedef struct {
+    FILE *outfile;
+    uint8_t block[255]; // data sub-block being filled
+    int used;
+    uint32_t bits; // coded bits not yet in block, low bits first
+    int nbits;
+    int size; // bits per code
+    int max_code; // last code in the table
+    int prefix; // code of the pixels read but not yet written, -1 none
+    int32_t key[GIF_HASH]; // 1 + (prefix << 8 | pixel) of a code, 0 free
+    uint16_t code[GIF_HASH];
+} gif_writer_t;
+
+void gif_frame_begin(gif_writer_t *w, FILE *outfile, int height, int width);
+void gif_frame_row(gif_writer_t *w, const int *bolt, int width);
+void gif_frame_end(gif_writer_t *w);
+
+#endif
@@ -1,138 +1,592 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "graph.h"
 
 #define MAXLINE 1024
 
+/* print_graph and print_charge format blocks of about FORMAT_BLOCK
+   cells, up to FORMAT_THREADS of them at once, one per thread */
+#define FORMAT_BLOCK (1 << 20)
+#define FORMAT_THREADS 8
+
 /**
  * store the whole graph and buffers
  */
 
+// zeroed height x width field with a ghost row of zeros above and
+// below, the stencil reads row -1 and row height without checks
+// row 0 is aligned
+real_t *new_field(arena_t *a, int height, int width) {
+    size_t ghost = (size_t)width * sizeof(real_t);
+    real_t *field = (real_t*)arena_alloc_at(a, (height + 2) * ghost, ghost);
+    if (field == NULL)
+        return NULL;
+    return field + width;
+}
+
 // initialize buffer
-static graph_t *new_graph(int width, int height, int power, int eta) {
+static graph_t *new_graph(int width, int height, int power, double eta) {
     graph_t *g = (graph_t*)malloc(sizeof(graph_t));
-    int nnode = width * height;
+    idx_t nnode = (idx_t)width * height;
+    size_t field = (size_t)(height + 2) * width * sizeof(real_t);
+    size_t cells = (size_t)nnode * sizeof(real_t);
+    idx_t i;
     if (g == NULL)
         return NULL;
+    // charge_buffer and dirichlet are only taken by the solvers that
+    // need them, until then they cost address space
+    g->arena = new_arena(2 * arena_span(field) + 2 * arena_span(cells) +
+                         arena_span(nnode * sizeof(int8_t)) + arena_span(nnode * sizeof(bolt_t)) +
+                         arena_span(nnode * sizeof(uint8_t)) + arena_span(nnode * sizeof(int)));
+    if (g->arena == NULL) {
+        free(g);
+        return NULL;
+    }
     g->width = width;
     g->height = height;
     g->power = power;
     g->eta = eta;
-    g->charge = (double*)calloc(nnode, sizeof(double));
-    g->charge_buffer = (double*)calloc(nnode, sizeof(double));
-    g->boundary = (double*)calloc(nnode, sizeof(double));
-    g->reset_bolt = (int*)calloc(nnode, sizeof(int));
-    g->bolt = (int*)calloc(nnode, sizeof(int));
+    g->grow = 1;
+    g->rng_seed = 1;
+    g->solver = SOLVER_JACOBI;
+    g->omega = 0.0;
+    g->tol = 0.0;
+    g->layout = LAYOUT_ROW;
+    g->format = FORMAT_TEXT;
+    g->charge = new_field(g->arena, height, width);
+    g->charge_buffer = NULL;
+    g->dirichlet = NULL;
+    g->boundary = (real_t*)arena_alloc(g->arena, cells);
+    g->reset_bolt = (int8_t*)arena_alloc(g->arena, nnode * sizeof(int8_t));
+    g->bolt = (bolt_t*)arena_alloc(g->arena, nnode * sizeof(bolt_t));
+    g->state = (uint8_t*)arena_alloc(g->arena, nnode * sizeof(uint8_t));
     g->num_choice = 0;
-    g->choice_probs = (double*)calloc(nnode, sizeof(double));
-    g->choice_idxs = (int*)calloc(nnode, sizeof(int));   
-    g->choosed = (int*)calloc(nnode, sizeof(int));  
-    g->path = (int*)calloc(nnode, sizeof(int));
+    g->max_choice = 0;
+    g->choice_probs = NULL;
+    g->choice_idxs = NULL;
+    g->choice_pos = (int*)arena_alloc(g->arena, nnode * sizeof(int));
+    g->num_seed = 0;
+    g->seed_idxs = NULL;
+    g->num_touched = 0;
+    g->max_touched = 0;
+    g->touched_idxs = NULL;
+    g->num_charged = 0;
+    g->max_charged = 0;
+    g->charged_idxs = NULL;
+    for (i = 0; i < nnode; i++) {
+        g->choice_pos[i] = -1;
+    }
 
     return g;
 }
 
 void free_graph(graph_t *g) {
-    free(g->charge);
-    free(g->charge_buffer);
-    free(g->boundary);
-    free(g->reset_bolt);
-    free(g->bolt);
+    free_arena(g->arena);
     free(g->choice_probs);
     free(g->choice_idxs);
-    free(g->path);
+    free(g->seed_idxs);
+    free(g->touched_idxs);
+    free(g->charged_idxs);
     free(g);
 }
 
-/* Read in graph file and build graph data structure */
-graph_t *read_graph(FILE *infile) {
-    graph_t *g = NULL;
+// the lists that grow with the lightning start at a fraction of the
+// cells and double when full, they never hold a cell twice so the
+// number of cells bounds them, their counts are int
+static int grow_max(graph_t *g, int max) {
+    idx_t cap = graph_cells(g) < INT_MAX ? graph_cells(g) : INT_MAX;
+    idx_t next = max > 0 ? 2 * (idx_t)max : cap / 64 + 16;
+    if (max >= cap) {
+        fprintf(stderr, "More than %d cells in a list\n", INT_MAX);
+        exit(1);
+    }
+    return (int)(next < cap ? next : cap);
+}
+
+/* room for one more choice */
+void grow_choices(graph_t *g) {
+    g->max_choice = grow_max(g, g->max_choice);
+    g->choice_probs = (double*)realloc(g->choice_probs, (size_t)g->max_choice * sizeof(double));
+    g->choice_idxs = (idx_t*)realloc(g->choice_idxs, (size_t)g->max_choice * sizeof(idx_t));
+}
+
+/* room for one more touched cell */
+void grow_touched(graph_t *g) {
+    g->max_touched = grow_max(g, g->max_touched);
+    g->touched_idxs = (idx_t*)realloc(g->touched_idxs, (size_t)g->max_touched * sizeof(idx_t));
+}
+
+/* room for one more charged cell */
+void grow_charged(graph_t *g) {
+    g->max_charged = grow_max(g, g->max_charged);
+    g->charged_idxs = (idx_t*)realloc(g->charged_idxs, (size_t)g->max_charged * sizeof(idx_t));
+}
+
+// read the bolts of one sign into p, returns 0 on bad input
+static int read_points(FILE *infile, graph_points_t *p, int bolt, const char *what) {
     char linebuf[MAXLINE];
-    int width, height, power, eta;
-    int num_negative, num_positive;
-    int x, y;
+    int count, x, y;
     int i;
+    if (fgets(linebuf, MAXLINE, infile) == NULL) {
+        return 0;
+    }
+    if (sscanf(linebuf, "%d", &count) != 1) {
+        fprintf(stderr, "Bad graph input %s bolts\n", what);
+        return 0;
+    }
+    p->row = (int*)realloc(p->row, (p->num_point + count) * sizeof(int));
+    p->col = (int*)realloc(p->col, (p->num_point + count) * sizeof(int));
+    p->bolt = (int*)realloc(p->bolt, (p->num_point + count) * sizeof(int));
+    for (i = 0; i < count; i++) {
+        if (fgets(linebuf, MAXLINE, infile) == NULL) {
+            return 0;
+        }
+        if (sscanf(linebuf, "%d %d", &y, &x) != 2) {
+            fprintf(stderr, "Bad graph input %s bolts\n", what);
+            return 0;
+        }
+        p->row[p->num_point] = y;
+        p->col[p->num_point] = x;
+        p->bolt[p->num_point] = bolt;
+        p->num_point++;
+    }
+    return 1;
+}
+
+/* Read in the header and bolt cells of a graph file */
+graph_points_t *read_graph_points(FILE *infile) {
+    graph_points_t *p = NULL;
+    char linebuf[MAXLINE];
 
     // Read header information
     if (fgets(linebuf, MAXLINE, infile) == NULL) {
         return NULL;
     }
-    if (sscanf(linebuf, "%d %d %d %d", &width, &height, &power, &eta) != 4) {
+    p = (graph_points_t*)calloc(1, sizeof(graph_points_t));
+    if (sscanf(linebuf, "%d %d %d %lf", &p->width, &p->height, &p->power, &p->eta) != 4) {
         fprintf(stderr, "Bad graph input Line 1\n");
+        free_graph_points(p);
         return NULL;
     }
-
-    g = new_graph(width, height, power, eta);
-    if (g == NULL) {
-        fprintf(stderr, "Create graph failed\n");
-	    return NULL;
-    }
-
-    // read positive bolts
-    if (fgets(linebuf, MAXLINE, infile) == NULL) {
+    // the weight kernels raise charges to eta >= 0 only
+    if (!(p->eta >= 0.0)) {
+        fprintf(stderr, "Eta must not be negative\n");
+        free_graph_points(p);
         return NULL;
     }
-    if (sscanf(linebuf, "%d", &num_positive) != 1) {
-        fprintf(stderr, "Bad graph input positive bolts\n");
+    if (!read_points(infile, p, 1, "positive") || !read_points(infile, p, -1, "negative")) {
+        free_graph_points(p);
         return NULL;
     }
-    for (i = 0; i < num_positive; i++) {
-        if (fgets(linebuf, MAXLINE, infile) == NULL) {
-            return NULL;
+    return p;
+}
+
+void free_graph_points(graph_points_t *p) {
+    free(p->row);
+    free(p->col);
+    free(p->bolt);
+    free(p);
+}
+
+// collect the reset bolts in row order, whatever the layout
+static void find_seeds(graph_t *g) {
+    int i, j;
+    g->num_seed = 0;
+    for (i = 0; i < g->height; i++) {
+        for (j = 0; j < g->width; j++) {
+            if (g->reset_bolt[cell_index(g, i, j)] > 0)
+                g->num_seed++;
         }
-        if (sscanf(linebuf, "%d %d", &y, &x) != 2) {
-            fprintf(stderr, "Bad graph input positive bolts\n");
-            return NULL;
+    }
+    free(g->seed_idxs);
+    g->seed_idxs = (idx_t*)malloc((size_t)(g->num_seed + 1) * sizeof(idx_t));
+    g->num_seed = 0;
+    for (i = 0; i < g->height; i++) {
+        for (j = 0; j < g->width; j++) {
+            idx_t idx = cell_index(g, i, j);
+            if (g->reset_bolt[idx] > 0)
+                g->seed_idxs[g->num_seed++] = idx;
         }
-        g->reset_bolt[y * g->width + x] = 1;
     }
+}
 
-    // read negative bolts
-    if (fgets(linebuf, MAXLINE, infile) == NULL) {
+/* Read in graph file and build graph data structure */
+graph_t *read_graph(FILE *infile) {
+    graph_points_t *p = read_graph_points(infile);
+    graph_t *g = NULL;
+    int i;
+
+    if (p == NULL) {
         return NULL;
     }
-    if (sscanf(linebuf, "%d", &num_negative) != 1) {
-        fprintf(stderr, "Bad graph input negative bolts\n");
+    if (p->power < 0 || p->power >= BOLT_MAX) {
+        fprintf(stderr, "Power must be below %d\n", BOLT_MAX);
+        free_graph_points(p);
         return NULL;
     }
-    for (i = 0; i < num_negative; i++) {
-        if (fgets(linebuf, MAXLINE, infile) == NULL) {
-            return NULL;
+    if ((double)p->width * p->height > (double)IDX_MAX) {
+        fprintf(stderr, "%d x %d cells need a wider index, build with INDEX=64\n",
+                p->height, p->width);
+        free_graph_points(p);
+        return NULL;
+    }
+    g = new_graph(p->width, p->height, p->power, p->eta);
+    if (g == NULL) {
+        fprintf(stderr, "Create graph failed\n");
+        free_graph_points(p);
+        return NULL;
+    }
+    for (i = 0; i < p->num_point; i++) {
+        g->reset_bolt[cell_index(g, p->row[i], p->col[i])] = p->bolt[i];
+    }
+    find_seeds(g);
+    free_graph_points(p);
+    return g;
+}
+
+// v in decimal as "%d" writes it, returns the end
+static char *put_int(char *out, int v) {
+    char digits[10];
+    unsigned u = v < 0 ? -(unsigned)v : (unsigned)v;
+    int n = 0;
+    if (v == 0) {
+        *out++ = '0';
+        return out;
+    }
+    if (v < 0)
+        *out++ = '-';
+    while (u > 0) {
+        digits[n++] = '0' + u % 10;
+        u /= 10;
+    }
+    while (n > 0)
+        *out++ = digits[--n];
+    return out;
+}
+
+// v as "%.2f" writes it, returns the end. printf rounds the exact
+// binary value half to even, fma tells on which side of a half the
+// exact v * 100 lies, v * 100 itself may round onto it
+static char *put_fixed2(char *out, double v) {
+    double a = fabs(v);
+    long long k;
+    double d;
+    int frac;
+    // k, k + 0.5 and k + 1 must be exact doubles
+    if (!(a < 1e13))
+        return out + sprintf(out, "%.2f", v);
+    if (signbit(v))
+        *out++ = '-';
+    k = (long long)(a * 100);
+    while (k > 0 && fma(a, 100.0, -(double)k) < 0)
+        k--;
+    while (fma(a, 100.0, -(double)(k + 1)) >= 0)
+        k++;
+    d = fma(a, 100.0, -((double)k + 0.5));
+    if (d > 0 || (d == 0 && (k & 1)))
+        k++;
+    frac = (int)(k % 100);
+    k /= 100;
+    if (k > INT_MAX) {
+        out += sprintf(out, "%lld", k);
+    } else {
+        out = put_int(out, (int)k);
+    }
+    *out++ = '.';
+    *out++ = '0' + frac / 10;
+    *out++ = '0' + frac % 10;
+    return out;
+}
+
+/* print one row of bolt values, the line format of a frame */
+void print_row(const int *bolt, int width, FILE *outfile) {
+    char *line = (char*)malloc((size_t)width * 12 + 1);
+    char *out = line;
+    int j;
+    for (j = 0; j < width; j++) {
+        out = put_int(out, bolt[j]);
+        *out++ = ' ';
+    }
+    *out++ = '\n';
+    fwrite(line, 1, out - line, outfile);
+    free(line);
+}
+
+typedef struct format_job format_job_t;
+typedef void (*format_rows_t)(format_job_t *job);
+
+// rows [top, bottom) of g, formatted into buf by format
+struct format_job {
+    graph_t *g;
+    format_rows_t format;
+    int top;
+    int bottom;
+    char *buf;
+    size_t len;
+    size_t cap;
+};
+
+// room for n more bytes in the buffer of job
+static char *reserve(format_job_t *job, size_t n) {
+    if (job->len + n > job->cap) {
+        job->cap = 2 * (job->len + n);
+        job->buf = (char*)realloc(job->buf, job->cap);
+    }
+    return job->buf + job->len;
+}
+
+// the rows of bolt in the line format of print_row, the cells of a row
+// are read in runs contiguous in memory
+static void format_bolt_rows(format_job_t *job) {
+    graph_t *g = job->g;
+    int n = cell_run(g);
+    int i, j, k;
+    for (i = job->top; i < job->bottom; i++) {
+        char *out = reserve(job, (size_t)g->width * 7 + 1);
+        for (j = 0; j < g->width; j += n) {
+            const bolt_t *run = g->bolt + cell_index(g, i, j);
+            for (k = 0; k < n; k++) {
+                out = put_int(out, run[k]);
+                *out++ = ' ';
+            }
         }
-        if (sscanf(linebuf, "%d %d", &y, &x) != 2) {
-            fprintf(stderr, "Bad graph input negative bolts\n");
-            return NULL;
+        *out++ = '\n';
+        job->len = out - job->buf;
+    }
+}
+
+static void format_charge_rows(format_job_t *job) {
+    graph_t *g = job->g;
+    int i, j;
+    for (i = job->top; i < job->bottom; i++) {
+        // 15 bytes hold any value put_fixed2 formats itself
+        char *out = reserve(job, (size_t)g->width * 16 + 1);
+        for (j = 0; j < g->width; j++) {
+            double v = (double)g->charge[cell_index(g, i, j)];
+            if (!(fabs(v) < 1e13)) {
+                job->len = out - job->buf;
+                out = reserve(job, 330 + (size_t)(g->width - j) * 16 + 1);
+            }
+            out = put_fixed2(out, v);
+            *out++ = ' ';
         }
-        g->reset_bolt[y * g->width + x] = -1;
+        *out++ = '\n';
+        job->len = out - job->buf;
     }
+}
 
-    return g;
+static void *format_rows(void *arg) {
+    format_job_t *job = (format_job_t*)arg;
+    job->len = 0;
+    job->format(job);
+    return NULL;
+}
+
+static int format_threads(void) {
+    static int cpus = 0;
+    if (cpus == 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        cpus = n > 0 ? (int)n : 1;
+    }
+    return cpus < FORMAT_THREADS ? cpus : FORMAT_THREADS;
+}
+
+// all rows of g through format, consecutive blocks of rows are
+// formatted on threads of their own and written in order, one fwrite
+// per block
+static void print_rows(graph_t *g, format_rows_t format, FILE *outfile) {
+    format_job_t job[FORMAT_THREADS];
+    pthread_t thread[FORMAT_THREADS];
+    int started[FORMAT_THREADS];
+    int rows = FORMAT_BLOCK / g->width > 0 ? FORMAT_BLOCK / g->width : 1;
+    int blocks = (g->height + rows - 1) / rows;
+    int nthread = format_threads() < blocks ? format_threads() : blocks;
+    int top, k;
+
+    memset(job, 0, sizeof(job));
+    for (top = 0; top < g->height; top += nthread * rows) {
+        for (k = 0; k < nthread; k++) {
+            job[k].g = g;
+            job[k].format = format;
+            job[k].top = top + k * rows < g->height ? top + k * rows : g->height;
+            job[k].bottom = top + (k + 1) * rows < g->height ? top + (k + 1) * rows : g->height;
+            started[k] = k > 0 && pthread_create(&thread[k], NULL, format_rows, &job[k]) == 0;
+        }
+        format_rows(&job[0]);
+        for (k = 1; k < nthread; k++) {
+            if (started[k])
+                pthread_join(thread[k], NULL);
+            else
+                format_rows(&job[k]);
+        }
+        for (k = 0; k < nthread; k++) {
+            fwrite(job[k].buf, 1, job[k].len, outfile);
+        }
+    }
+    for (k = 0; k < FORMAT_THREADS; k++) {
+        free(job[k].buf);
+    }
 }
 
 /* print the bolt value to outfile */
 void print_graph(graph_t *g, FILE *outfile) {
+    print_rows(g, format_bolt_rows, outfile);
+}
+
+// one row at a time, the LZW state is the only thing kept of the frame
+static void print_gif(graph_t *g, FILE *outfile) {
+    gif_writer_t *w = (gif_writer_t*)malloc(sizeof(gif_writer_t));
+    int *row = (int*)malloc(g->width * sizeof(int));
     int i, j;
+    gif_frame_begin(w, outfile, g->height, g->width);
     for (i = 0; i < g->height; i++) {
         for (j = 0; j < g->width; j++) {
-            fprintf(outfile, "%d", g->bolt[i * g->width + j]);
-            if (j != g->width) {
-                fprintf(outfile, " ");
-            }
+            row[j] = g->bolt[cell_index(g, i, j)];
         }
+        gif_frame_row(w, row, g->width);
+    }
+    gif_frame_end(w);
+    free(row);
+    free(w);
+}
+
+/* write the bolt as one frame of g->format */
+void print_frame(graph_t *g, FILE *outfile) {
+    bin_writer_t w;
+    int i, j;
+    if (g->format == FORMAT_TEXT) {
+        print_graph(g, outfile);
         fprintf(outfile, "\n");
+        return;
+    }
+    if (g->format == FORMAT_GIF) {
+        print_gif(g, outfile);
+        return;
+    }
+    bin_frame_begin(&w, outfile);
+    for (i = 0; i < g->height; i++) {
+        for (j = 0; j < g->width; j++) {
+            bolt_t bolt = g->bolt[cell_index(g, i, j)];
+            if (bolt != 0)
+                bin_frame_cell(&w, (int64_t)i * g->width + j, bolt);
+        }
     }
+    bin_frame_end(&w);
 }
 
 void print_charge(graph_t *g, FILE *outfile) {
+    print_rows(g, format_charge_rows, outfile);
+}
+
+static const char *solver_name[SOLVER_COUNT] = { "jacobi", "sor", "mg", "local", "quad" };
+
+/* map -S argument to solver, return 0 if unknown */
+int parse_solver(const char *name, solver_t *solver) {
+    int i;
+    for (i = 0; i < SOLVER_COUNT; i++) {
+        if (strcmp(name, solver_name[i]) == 0) {
+            *solver = (solver_t)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static const char *layout_name[LAYOUT_COUNT] = { "row", "tile" };
+
+/* map -L argument to layout, return 0 if unknown */
+int parse_layout(const char *name, layout_t *layout) {
+    int i;
+    for (i = 0; i < LAYOUT_COUNT; i++) {
+        if (strcmp(name, layout_name[i]) == 0) {
+            *layout = (layout_t)i;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* reorder the graph read by read_graph into layout, before simulate
+   return 0 if the graph sides don't fit the layout */
+int set_layout(graph_t *g, layout_t layout) {
     int i, j;
+    int8_t *old_bolt;
+    graph_t old = *g;
+    if (layout == LAYOUT_TILE &&
+        (g->width % LAYOUT_TILE_SIDE != 0 || g->height % LAYOUT_TILE_SIDE != 0))
+        return 0;
+    // reorder in place through a copy, the arena buffer stays
+    old_bolt = (int8_t*)malloc((size_t)g->height * g->width * sizeof(int8_t));
+    memcpy(old_bolt, g->reset_bolt, (size_t)g->height * g->width * sizeof(int8_t));
+    g->layout = layout;
     for (i = 0; i < g->height; i++) {
         for (j = 0; j < g->width; j++) {
-            fprintf(outfile, "%.2lf", g->charge[i * g->width + j]);
-            if (j != g->width) {
-                fprintf(outfile, " ");
-            }
+            g->reset_bolt[cell_index(g, i, j)] = old_bolt[cell_index(&old, i, j)];
         }
-        fprintf(outfile, "\n");
     }
+    free(old_bolt);
+    find_seeds(g);
+    return 1;
+}
+
+/* optimal SOR factor for the poisson equation on the longer side */
+double default_omega(graph_t *g) {
+    int n = g->width > g->height ? g->width : g->height;
+    return 2.0 / (1.0 + sin(M_PI / n));
+}
+
+/* hint the arena about rows [top, bottom) of the fields a sweep reads
+   and writes, the rows of a band of storage tiles are contiguous in
+   both layouts */
+void advise_rows(graph_t *g, int top, int bottom, arena_advice_t advice) {
+    real_t *fields[4] = { g->charge, g->charge_buffer, g->dirichlet, g->boundary };
+    idx_t first, last;
+    int k;
+    top = top > 0 ? top : 0;
+    bottom = bottom < g->height ? bottom : g->height;
+    if (top >= bottom)
+        return;
+    first = cell_index(g, top, 0);
+    last = bottom == g->height ? graph_cells(g) : cell_index(g, bottom, 0);
+    for (k = 0; k < 4; k++) {
+        if (fields[k] != NULL)
+            arena_advise(g->arena, fields[k] + first, (size_t)(last - first) * sizeof(real_t), advice);
+    }
+}
+
+static size_t show_bytes(FILE *outfile, const char *name, size_t bytes, idx_t nnode) {
+    fprintf(outfile, "  %-16s %12zu B %8.2f B/cell\n", name, bytes, (double)bytes / nnode);
+    return bytes;
+}
+
+/* bytes held by each array of g, the growing lists at their capacity */
+void print_memory(graph_t *g, FILE *outfile) {
+    idx_t nnode = graph_cells(g);
+    size_t field = (size_t)(g->height + 2) * g->width * sizeof(real_t);
+    size_t total = 0;
+    fprintf(outfile, "Memory of the %d x %d graph, %d bit cell indices\n",
+            g->height, g->width, (int)(8 * sizeof(idx_t)));
+    fprintf(outfile, "  arena of %zu B, %zu B handed out, %s pages%s\n",
+            g->arena->size, g->arena->used, pages_name(g->arena->pages),
+            g->arena->file ? ", file backed" : "");
+    total += show_bytes(outfile, "charge", field, nnode);
+    if (g->charge_buffer != NULL)
+        total += show_bytes(outfile, "charge_buffer", field, nnode);
+    if (g->dirichlet != NULL)
+        total += show_bytes(outfile, "dirichlet", (size_t)nnode * sizeof(real_t), nnode);
+    total += show_bytes(outfile, "boundary", (size_t)nnode * sizeof(real_t), nnode);
+    total += show_bytes(outfile, "reset_bolt", (size_t)nnode * sizeof(int8_t), nnode);
+    total += show_bytes(outfile, "bolt", (size_t)nnode * sizeof(bolt_t), nnode);
+    total += show_bytes(outfile, "state", (size_t)nnode * sizeof(uint8_t), nnode);
+    total += show_bytes(outfile, "choice_pos", (size_t)nnode * sizeof(int), nnode);
+    total += show_bytes(outfile, "choices", (size_t)g->max_choice * (sizeof(double) + sizeof(idx_t)), nnode);
+    total += show_bytes(outfile, "seed_idxs", (size_t)(g->num_seed + 1) * sizeof(idx_t), nnode);
+    total += show_bytes(outfile, "touched_idxs", (size_t)g->max_touched * sizeof(idx_t), nnode);
+    total += show_bytes(outfile, "charged_idxs", (size_t)g->max_charged * sizeof(idx_t), nnode);
+    show_bytes(outfile, "total", total, nnode);
 }
@@ -1,33 +1,215 @@
 #ifndef __GRAPH_H__
 #define __GRAPH_H__
 #include <stdio.h>
+#include <stdint.h>
+#include "arena.h"
+#include "frame.h"
+
+// field solvers selectable with -S
+// quad is the adaptive quadtree mesh of light-seq, it has no graph_t
+typedef enum { SOLVER_JACOBI, SOLVER_SOR, SOLVER_MG, SOLVER_LOCAL, SOLVER_QUAD, SOLVER_COUNT } solver_t;
+
+/* Precision of the potential field, make FLOAT=0|1|2:
+   0 double, 1 float storage with double sums, 2 float throughout */
+#if FLOAT_FIELD
+typedef float real_t;
+#else
+typedef double real_t;
+#endif
+#if FLOAT_FIELD == 2
+typedef float acc_t;
+#else
+typedef double acc_t;
+#endif
+
+/* Index of a cell in the cell arrays, make INDEX=32|64: 64 for graphs
+   of 2^31 cells or more, 32 keeps the index lists half as large.
+   Sides, counts of the lists and frontier slots stay int */
+#if INDEX_BITS == 64
+typedef int64_t idx_t;
+#define IDX_MAX INT64_MAX
+#else
+typedef int32_t idx_t;
+#define IDX_MAX INT32_MAX
+#endif
+
+// storage order of the cell arrays selectable with -L
+typedef enum { LAYOUT_ROW, LAYOUT_TILE, LAYOUT_COUNT } layout_t;
+
+/* LAYOUT_TILE stores square tiles of LAYOUT_TILE_SIDE cells one after
+   another, row-major inside a tile and tiles row-major in the graph */
+#define LAYOUT_TILE_SHIFT 5
+#define LAYOUT_TILE_SIDE (1 << LAYOUT_TILE_SHIFT)
+
+/* Bolt value of a cell: 0 free, < 0 ground, > 0 bolt, 1 plus the
+   charge discharged through it. A lightning reaches at most power
+   grounds, read_graph refuses a power that would overflow a cell */
+typedef int16_t bolt_t;
+#define BOLT_MAX INT16_MAX
+
+/* graph_t.state of a cell: the low bits are the side of the bolt cell
+   it was reached from, where a discharge goes on to, CELL_TOUCHED marks
+   it as listed in touched_idxs */
+#define CELL_PATH_NONE 0
+#define CELL_PATH_UP 1
+#define CELL_PATH_LEFT 2
+#define CELL_PATH_RIGHT 3
+#define CELL_PATH_DOWN 4
+#define CELL_PATH_MASK 7
+#define CELL_TOUCHED 8
 
 typedef struct {
     int width;
     int height;
     int power; // #branchs of lightning
-    int eta; // shape of lightning
+    double eta; // shape of lightning, a choice weighs charge^eta
+    int grow; // bolt cells drawn per solve
+    unsigned long rng_seed; // key of the random streams (rng.h)
 
-    // electrical potential
-    double *charge;
-    double *charge_buffer;
+    solver_t solver; // how the potential is relaxed
+    double omega; // over-relaxation factor of SOR and local
+    double tol; // residual target of a solve, 0 for fixed sweep counts
+    layout_t layout; // order of charge, boundary, bolt, state, ... in memory
+    format_t format; // of the frames print_frame writes
+
+    // the buffers of size width x height below come from this arena,
+    // the lists that grow with the lightning are malloc'd
+    arena_t *arena;
+
+    // electrical potential, fields are allocated with new_field and
+    // have a ghost row of zeros above and below
+    real_t *charge;
+    real_t *charge_buffer; // only allocated by solvers that need it
+    real_t *dirichlet; // potential of bolt cells, negative for free cells (jacobi only)
 
     // charge density (poisson equation)
-    double *boundary;
+    real_t *boundary;
+
+    int8_t *reset_bolt; // 1, -1 or 0 as read from the graph file
+    bolt_t *bolt;
+    uint8_t *state; // CELL_PATH_* and CELL_TOUCHED
 
-    int *reset_bolt;
-    int *bolt;
-    
+    // reset bolts (> 0) in row order, the frontier of a lightning
+    // starts around them
+    int num_seed;
+    idx_t *seed_idxs;
+
+    // frontier, the free cells next to the bolt, a cell leaves it with
+    // a swap with the last one when it becomes bolt
+    // the lists hold max_choice entries and grow with the frontier
     int num_choice;
+    int max_choice;
     double *choice_probs;
-    int *choice_idxs;
-    int *choosed;
-    int *path;
+    idx_t *choice_idxs;
+    int *choice_pos; // slot of the cell in choice_idxs, -1 if none
+
+    // cells whose bolt or path the lightning changed, the next one
+    // resets only these
+    int num_touched;
+    int max_touched;
+    idx_t *touched_idxs;
+
+    // cells with a charge density, rebuilt from the touched ones
+    int num_charged;
+    int max_charged;
+    idx_t *charged_idxs;
 }graph_t;
 
+void grow_choices(graph_t *g);
+void grow_touched(graph_t *g);
+void grow_charged(graph_t *g);
+
+// cells of the graph
+static inline idx_t graph_cells(const graph_t *g) {
+    return (idx_t)g->width * g->height;
+}
+
+// index of cell (i, j) in the cell arrays
+static inline idx_t cell_index(const graph_t *g, int i, int j) {
+    int mask = LAYOUT_TILE_SIDE - 1;
+    if (g->layout == LAYOUT_TILE) {
+        idx_t tile = (idx_t)(i >> LAYOUT_TILE_SHIFT) * (g->width >> LAYOUT_TILE_SHIFT) + (j >> LAYOUT_TILE_SHIFT);
+        return (tile << (2 * LAYOUT_TILE_SHIFT)) | ((i & mask) << LAYOUT_TILE_SHIFT) | (j & mask);
+    }
+    return (idx_t)i * g->width + j;
+}
+
+// row and column of the cell at index idx
+static inline int cell_row(const graph_t *g, idx_t idx) {
+    if (g->layout == LAYOUT_TILE) {
+        idx_t tile = idx >> (2 * LAYOUT_TILE_SHIFT);
+        return (int)(tile / (g->width >> LAYOUT_TILE_SHIFT)) << LAYOUT_TILE_SHIFT |
+               (int)((idx >> LAYOUT_TILE_SHIFT) & (LAYOUT_TILE_SIDE - 1));
+    }
+    return (int)(idx / g->width);
+}
+
+static inline int cell_col(const graph_t *g, idx_t idx) {
+    if (g->layout == LAYOUT_TILE) {
+        idx_t tile = idx >> (2 * LAYOUT_TILE_SHIFT);
+        return (int)(tile % (g->width >> LAYOUT_TILE_SHIFT)) << LAYOUT_TILE_SHIFT | (int)(idx & (LAYOUT_TILE_SIDE - 1));
+    }
+    return (int)(idx % g->width);
+}
+
+// cells of a row that lie next to each other in memory
+static inline int cell_run(const graph_t *g) {
+    return g->layout == LAYOUT_TILE ? LAYOUT_TILE_SIDE : g->width;
+}
+
+// note cell idx as changed by the current lightning
+static inline void touch_cell(graph_t *g, idx_t idx) {
+    if (!(g->state[idx] & CELL_TOUCHED)) {
+        g->state[idx] |= CELL_TOUCHED;
+        if (g->num_touched == g->max_touched)
+            grow_touched(g);
+        g->touched_idxs[g->num_touched++] = idx;
+    }
+}
+
+// the cell a discharge goes on to from idx, -1 at the end of the path
+static inline idx_t path_next(const graph_t *g, idx_t idx) {
+    int i = cell_row(g, idx);
+    int j = cell_col(g, idx);
+    switch (g->state[idx] & CELL_PATH_MASK) {
+    case CELL_PATH_UP:
+        return cell_index(g, i - 1, j);
+    case CELL_PATH_LEFT:
+        return cell_index(g, i, j - 1);
+    case CELL_PATH_RIGHT:
+        return cell_index(g, i, j + 1);
+    case CELL_PATH_DOWN:
+        return cell_index(g, i + 1, j);
+    }
+    return -1;
+}
+
+// header and bolt cells of a graph file, without the per cell arrays
+typedef struct {
+    int width;
+    int height;
+    int power;
+    double eta;
+    int num_point;
+    int *row;
+    int *col;
+    int *bolt; // 1 positive, -1 negative
+} graph_points_t;
+
+graph_points_t *read_graph_points(FILE *infile);
+void free_graph_points(graph_points_t *p);
 graph_t *read_graph(FILE *infile);
 void free_graph(graph_t *g);
+void print_row(const int *bolt, int width, FILE *outfile);
 void print_graph(graph_t *g, FILE *outfile);
+void print_frame(graph_t *g, FILE *outfile);
 void print_charge(graph_t *g, FILE *outfile);
+int parse_solver(const char *name, solver_t *solver);
+double default_omega(graph_t *g);
+int parse_layout(const char *name, layout_t *layout);
+int set_layout(graph_t *g, layout_t layout);
+real_t *new_field(arena_t *a, int height, int width);
+void advise_rows(graph_t *g, int top, int bottom, arena_advice_t advice);
+void print_memory(graph_t *g, FILE *outfile);
 
 #endif
\ No newline at end of file
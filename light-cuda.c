@@ -6,14 +6,19 @@
 #include "sim.h"
 #include "instrument.h"
 
+#if FLOAT_FIELD
+#error "sim-cuda.cu works on a double field, build with FLOAT=0"
+#endif
+
 static void usage(char *name) {
-    const char *use_string = "-g GFILE [-n STEPS] [-s SEED] [-u (r|b|s)] [-q] [-I]";
+    const char *use_string = "-g GFILE [-n STEPS] [-s SEED] [-u (r|b|s)] [-q] [-I] [-f FORMAT]";
     fprintf(stdout, "Usage: %s %s\n", name, use_string);
     fprintf(stdout, "   -h        Print this message\n");
     fprintf(stdout, "   -g GFILE  Graph file\n");
     fprintf(stdout, "   -n STEPS  Number of simulation steps\n");
     fprintf(stdout, "   -s SEED   Initial RNG seed\n");
     fprintf(stdout, "   -I        Instrument simulation activities\n");
+    fprintf(stdout, "   -f FORMAT Format of the frames (text|bin|gif), frame-text turns bin into text\n");
     exit(0);
 }
 
@@ -24,9 +29,10 @@ int main(int argc, char *argv[]) {
     int count = 10;
     unsigned long seed = 1;
     bool instrument = false;
+    format_t format = FORMAT_TEXT;
 
     char c;
-    const char *optstring = "hg:o:n:s:I";
+    const char *optstring = "hg:o:n:s:If:";
     while ((c = getopt(argc, argv, optstring)) != -1) {
         switch(c) {
         case 'h':
@@ -47,6 +53,12 @@ int main(int argc, char *argv[]) {
         case 'I':
             instrument = true;
             break;
+        case 'f':
+            if (!parse_format(optarg, &format)) {
+                fprintf(stdout, "Unknown format '%s'\n", optarg);
+                usage(argv[0]);
+            }
+            break;
         default:
             fprintf(stdout, "Unknown option '%c'\n", c);
             usage(argv[0]);
@@ -65,9 +77,10 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
     fclose(gfile);
-    srand(seed);
+    g->rng_seed = seed;
+    g->format = format;
 
-    fprintf(ofile, "%d %d %d\n", g->height, g->width, count);
+    write_header(ofile, format, g->height, g->width, count);
     FINISH_ACTIVITY(ACTIVITY_STARTUP);
 
     simulate(g, count, ofile);
@@ -75,6 +88,7 @@ int main(int argc, char *argv[]) {
     SHOW_ACTIVITY(stderr, instrument);
 
     free_graph(g);
+    write_trailer(ofile, format);
     fclose(ofile);
 
     return 0;
@@ -9,13 +9,18 @@
 #include "instrument.h"
 
 static void usage(char *name) {
-    char *use_string = "-g GFILE [-n STEPS] [-s SEED] [-u (r|b|s)] [-q] [-I]";
+    char *use_string = "-g GFILE [-n STEPS] [-s SEED] [-u (r|b|s)] [-q] [-k K] [-I] [-M] [-H PAGES] [-D DIR] [-f FORMAT]";
     fprintf(stdout, "Usage: %s %s\n", name, use_string);
     fprintf(stdout, "   -h        Print this message\n");
     fprintf(stdout, "   -g GFILE  Graph file\n");
     fprintf(stdout, "   -n STEPS  Number of simulation steps\n");
     fprintf(stdout, "   -s SEED   Initial RNG seed\n");
+    fprintf(stdout, "   -k K      Bolt cells drawn per field solve\n");
     fprintf(stdout, "   -I        Instrument simulation activities\n");
+    fprintf(stdout, "   -M        Report the memory of the master's graph arrays\n");
+    fprintf(stdout, "   -H PAGES  Pages of the grid buffers (small|thp|huge)\n");
+    fprintf(stdout, "   -D DIR    Keep the grid buffers in files of DIR, for graphs larger than memory\n");
+    fprintf(stdout, "   -f FORMAT Format of the frames (text|bin|gif), frame-text turns bin into text\n");
     exit(0);
 }
 
@@ -27,7 +32,12 @@ int main(int argc, char *argv[]) {
     zone_t *zone = NULL;
     int count = 10;
     unsigned long seed = 1;
+    int grow = 1;
     bool instrument = false;
+    bool memory = false;
+    arena_pages_t pages = PAGES_SMALL;
+    char *dir = NULL;
+    format_t format = FORMAT_TEXT;
     int process_count;
     int this_zone;
     bool mpi_master;
@@ -37,7 +47,7 @@ int main(int argc, char *argv[]) {
     mpi_master = this_zone == 0;
 
     char c;
-    char *optstring = "hg:o:n:s:t:I";
+    char *optstring = "hg:o:n:s:t:k:IMH:D:f:";
     while ((c = getopt(argc, argv, optstring)) != -1) {
         switch(c) {
         case 'h':
@@ -58,9 +68,35 @@ int main(int argc, char *argv[]) {
         case 's':
             seed = strtoul(optarg, NULL, 0);
             break;
+        case 'k':
+            grow = atoi(optarg);
+            if (grow < 1) {
+                if (mpi_master)
+                    fprintf(stdout, "K must be at least 1\n");
+                exit(1);
+            }
+            break;
         case 'I':
             instrument = true;
             break;
+        case 'M':
+            memory = true;
+            break;
+        case 'H':
+            if (!parse_pages(optarg, &pages)) {
+                fprintf(stdout, "Unknown pages '%s'\n", optarg);
+                usage(argv[0]);
+            }
+            break;
+        case 'D':
+            dir = optarg;
+            break;
+        case 'f':
+            if (!parse_format(optarg, &format)) {
+                fprintf(stdout, "Unknown format '%s'\n", optarg);
+                usage(argv[0]);
+            }
+            break;
         default:
             fprintf(stdout, "Unknown option '%c'\n", c);
             usage(argv[0]);
@@ -69,6 +105,8 @@ int main(int argc, char *argv[]) {
     }
 
     track_activity(instrument);
+    set_arena_pages(pages);
+    set_arena_dir(dir);
     START_ACTIVITY(ACTIVITY_STARTUP);
 
     if (mpi_master) {
@@ -81,9 +119,11 @@ int main(int argc, char *argv[]) {
             exit(1);
         }
         fclose(gfile);
-        srand(seed);
+        g->grow = grow;
+        g->rng_seed = seed;
+        g->format = format;
 
-        fprintf(ofile, "%d %d %d\n", g->height, g->width, count);
+        write_header(ofile, format, g->height, g->width, count);
 
         // divide into zones
         int i;
@@ -97,11 +137,15 @@ int main(int argc, char *argv[]) {
     FINISH_ACTIVITY(ACTIVITY_STARTUP);
 
     simulate(process_count, mpi_master, g, zonedef_list, zone, count, ofile);
+    free_zone(zone);
 
     if (mpi_master) {
         SHOW_ACTIVITY(stderr, instrument);
+        if (memory)
+            print_memory(g, stderr);
         free_zonedef_list(zonedef_list, process_count);
         free_graph(g);
+        write_trailer(ofile, format);
         fclose(ofile);
     }
 
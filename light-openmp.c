@@ -8,14 +8,23 @@
 #include "instrument.h"
 
 static void usage(char *name) {
-    char *use_string = "-g GFILE [-n STEPS] [-s SEED] [-u (r|b|s)] [-q] [-t THD] [-I]";
+    char *use_string = "-g GFILE [-n STEPS] [-s SEED] [-u (r|b|s)] [-q] [-t THD] [-S SOLVER] [-w OMEGA] [-T TOL] [-L LAYOUT] [-k K] [-I] [-M] [-H PAGES] [-D DIR] [-f FORMAT]";
     fprintf(stdout, "Usage: %s %s\n", name, use_string);
     fprintf(stdout, "   -h        Print this message\n");
     fprintf(stdout, "   -g GFILE  Graph file\n");
     fprintf(stdout, "   -n STEPS  Number of simulation steps\n");
     fprintf(stdout, "   -s SEED   Initial RNG seed\n");
     fprintf(stdout, "   -t THD    Set number of threads\n");
+    fprintf(stdout, "   -S SOLVER Field solver (jacobi|sor|mg|local)\n");
+    fprintf(stdout, "   -w OMEGA  Over-relaxation factor of SOR and local\n");
+    fprintf(stdout, "   -T TOL    Relax until the max residual is below TOL\n");
+    fprintf(stdout, "   -L LAYOUT Cell storage order (row|tile), tile needs jacobi\n");
+    fprintf(stdout, "   -k K      Bolt cells drawn per field solve\n");
     fprintf(stdout, "   -I        Instrument simulation activities\n");
+    fprintf(stdout, "   -M        Report the memory of the graph arrays\n");
+    fprintf(stdout, "   -H PAGES  Pages of the grid buffers (small|thp|huge)\n");
+    fprintf(stdout, "   -D DIR    Keep the grid buffers in files of DIR, for graphs larger than memory\n");
+    fprintf(stdout, "   -f FORMAT Format of the frames (text|bin|gif), frame-text turns bin into text\n");
     exit(0);
 }
 
@@ -26,10 +35,19 @@ int main(int argc, char *argv[]) {
     int count = 10;
     int thread_count = 1;
     unsigned long seed = 1;
+    solver_t solver = SOLVER_JACOBI;
+    double omega = 0.0;
+    double tol = 0.0;
+    layout_t layout = LAYOUT_ROW;
+    int grow = 1;
     bool instrument = false;
+    bool memory = false;
+    arena_pages_t pages = PAGES_SMALL;
+    char *dir = NULL;
+    format_t format = FORMAT_TEXT;
 
     char c;
-    char *optstring = "hg:o:n:s:t:I";
+    char *optstring = "hg:o:n:s:t:S:w:T:L:k:IMH:D:f:";
     while ((c = getopt(argc, argv, optstring)) != -1) {
         switch(c) {
         case 'h':
@@ -50,9 +68,52 @@ int main(int argc, char *argv[]) {
         case 't':
             thread_count = atoi(optarg);
             break;
+        case 'S':
+            if (!parse_solver(optarg, &solver)) {
+                fprintf(stdout, "Unknown solver '%s'\n", optarg);
+                usage(argv[0]);
+            }
+            break;
+        case 'w':
+            omega = atof(optarg);
+            break;
+        case 'T':
+            tol = atof(optarg);
+            break;
+        case 'L':
+            if (!parse_layout(optarg, &layout)) {
+                fprintf(stdout, "Unknown layout '%s'\n", optarg);
+                usage(argv[0]);
+            }
+            break;
+        case 'k':
+            grow = atoi(optarg);
+            if (grow < 1) {
+                fprintf(stdout, "K must be at least 1\n");
+                usage(argv[0]);
+            }
+            break;
         case 'I':
             instrument = true;
             break;
+        case 'M':
+            memory = true;
+            break;
+        case 'H':
+            if (!parse_pages(optarg, &pages)) {
+                fprintf(stdout, "Unknown pages '%s'\n", optarg);
+                usage(argv[0]);
+            }
+            break;
+        case 'D':
+            dir = optarg;
+            break;
+        case 'f':
+            if (!parse_format(optarg, &format)) {
+                fprintf(stdout, "Unknown format '%s'\n", optarg);
+                usage(argv[0]);
+            }
+            break;
         default:
             fprintf(stdout, "Unknown option '%c'\n", c);
             usage(argv[0]);
@@ -61,6 +122,8 @@ int main(int argc, char *argv[]) {
     }
 
     track_activity(instrument);
+    set_arena_pages(pages);
+    set_arena_dir(dir);
     START_ACTIVITY(ACTIVITY_STARTUP);
     omp_set_num_threads(thread_count);
     if (gfile == NULL) {
@@ -72,16 +135,36 @@ int main(int argc, char *argv[]) {
         exit(1);
     }
     fclose(gfile);
-    srand(seed);
+    if (layout != LAYOUT_ROW && solver != SOLVER_JACOBI) {
+        fprintf(stdout, "Only the jacobi solver supports the tile layout\n");
+        exit(1);
+    }
+    if (solver == SOLVER_QUAD) {
+        fprintf(stdout, "The quad solver only runs in light-seq\n");
+        exit(1);
+    }
+    if (!set_layout(g, layout)) {
+        fprintf(stdout, "Graph sides must be multiples of %d for this layout\n", LAYOUT_TILE_SIDE);
+        exit(1);
+    }
+    g->solver = solver;
+    g->omega = omega > 0.0 ? omega : default_omega(g);
+    g->tol = tol;
+    g->grow = grow;
+    g->rng_seed = seed;
+    g->format = format;
 
-    fprintf(ofile, "%d %d %d\n", g->height, g->width, count);
+    write_header(ofile, format, g->height, g->width, count);
     FINISH_ACTIVITY(ACTIVITY_STARTUP);
 
     simulate(g, count, ofile);
 
     SHOW_ACTIVITY(stderr, instrument);
+    if (memory)
+        print_memory(g, stderr);
 
     free_graph(g);
+    write_trailer(ofile, format);
     fclose(ofile);
 
     return 0;
@@ -2,12 +2,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <limits.h>
 #include <mpi.h>
 #include "graph.h"
 #include "mpiutil.h"
+#include "stencil.h"
 #include "instrument.h"
 
-static zone_t *new_zone(int this_zone, int gheight, int gwidth, int start_row, int start_col, int height, int width, int eta) {
+static zone_t *new_zone(int this_zone, int gheight, int gwidth, int start_row, int start_col, int height, int width, double eta) {
     zone_t *res = (zone_t*)calloc(1, sizeof(zone_t));
     res->this_zone = this_zone;
     res->gheight = gheight;
@@ -18,17 +20,27 @@ static zone_t *new_zone(int this_zone, int gheight, int gwidth, int start_row, i
     res->width = width;
     res->eta = eta;
 
-    res->charge = (double *)calloc(height * width, sizeof(double));
-    res->charge_buffer = (double*)calloc(height * width, sizeof(double));
-    res->ghost_charge = (double*)calloc(2 * (height + width), sizeof(double));
-    res->boundary = (double*)calloc(height * width, sizeof(double));
-    res->reset_bolt = (int*)calloc(height * width, sizeof(int));
-    res->bolt = (int*)calloc(height * width, sizeof(int));
-    
-    res->left_buf = (double*)calloc(height, sizeof(double));
-    res->right_buf = (double*)calloc(height, sizeof(double));
-    res->choice_idxs = (int*)calloc(height * width, sizeof(int));
-    res->prob_buf = (double*)calloc(height * width, sizeof(double));
+    res->pitch = width + 2;
+    size_t padded = (size_t)(height + 2) * res->pitch * sizeof(real_t);
+    size_t cells = (size_t)height * width;
+    res->arena = new_arena(2 * arena_span(padded) + 2 * arena_span(cells * sizeof(real_t)) +
+                           2 * arena_span(cells * sizeof(bolt_t)));
+    res->charge = (real_t*)arena_alloc(res->arena, padded);
+    res->charge_buffer = (real_t*)arena_alloc(res->arena, padded);
+    res->dirichlet = (real_t*)arena_alloc(res->arena, cells * sizeof(real_t));
+    res->boundary = (real_t*)arena_alloc(res->arena, cells * sizeof(real_t));
+    res->reset_bolt = (bolt_t*)arena_alloc(res->arena, cells * sizeof(bolt_t));
+    res->bolt = (bolt_t*)arena_alloc(res->arena, cells * sizeof(bolt_t));
+
+    MPI_Type_vector(height, 1, res->pitch, MPI_REAL_T, &res->col_type);
+    MPI_Type_commit(&res->col_type);
+    MPI_Type_vector(height, width, res->pitch, MPI_REAL_T, &res->zone_type);
+    MPI_Type_commit(&res->zone_type);
+    MPI_Type_contiguous(width, MPI_BOLT_T, &res->bolt_row);
+    MPI_Type_commit(&res->bolt_row);
+    res->max_choice = 0;
+    res->choice_idxs = NULL;
+    res->prob_buf = NULL;
     return res;
 }
 
@@ -36,6 +48,8 @@ static zone_t *new_zone(int this_zone, int gheight, int gwidth, int start_row, i
 // divide graph into zones
 zonedef_t *generate_zones(graph_t *g, int process_count) {
     zonedef_t *res;
+    arena_t *arena;
+    size_t size = 0;
     int i, j, idx;
     int num_row = (int)sqrt(process_count); // how many rows of zones
     int num_col = process_count / num_row; // how many columns of zones
@@ -75,6 +89,14 @@ zonedef_t *generate_zones(graph_t *g, int process_count) {
         }
     }
 
+    // one arena for the buffers of every zone
+    for (idx = 0; idx < process_count; idx++) {
+        size_t cells = (size_t)res[idx].width * res[idx].height;
+        size += arena_span(cells * sizeof(real_t)) + arena_span(cells * sizeof(bolt_t)) +
+                arena_span(cells * sizeof(int));
+    }
+    arena = new_arena(size);
+
     // store data
     for (idx = 0; idx < process_count; idx++) {
         int start_row = res[idx].start_row;
@@ -83,20 +105,27 @@ zonedef_t *generate_zones(graph_t *g, int process_count) {
         int width = res[idx].width;
 
         res[idx].eta = g->eta;
-        res[idx].charge = calloc(width * height, sizeof(double));
-        res[idx].boundary = calloc(width * height, sizeof(double));
-        res[idx].bolt = calloc(width * height, sizeof(int));
-        res[idx].choice_idxs = calloc(width * height, sizeof(int));
-        res[idx].choice_idx_map = calloc(width * height, sizeof(int));
-        res[idx].probs = calloc(width * height, sizeof(double));
-
-        int b_idx = 0;
-        int g_idx;
+        res[idx].arena = arena;
+        res[idx].charge = arena_alloc(arena, (size_t)width * height * sizeof(real_t));
+        res[idx].bolt = arena_alloc(arena, (size_t)width * height * sizeof(bolt_t));
+        res[idx].max_choice = 0;
+        res[idx].choice_idxs = NULL;
+        res[idx].choice_idx_map = NULL;
+        res[idx].choice_pos = arena_alloc(arena, (size_t)width * height * sizeof(int));
+        res[idx].probs = NULL;
+        MPI_Type_contiguous(width, MPI_REAL_T, &res[idx].charge_row);
+        MPI_Type_commit(&res[idx].charge_row);
+        MPI_Type_contiguous(width, MPI_BOLT_T, &res[idx].bolt_row);
+        MPI_Type_commit(&res[idx].bolt_row);
+
+        idx_t b_idx = 0;
+        idx_t g_idx;
         for (i = start_row; i < start_row + height; i++) {
             for (j = start_col; j < start_col + width; j++) {
-                g_idx = i * g->width + j;
+                g_idx = (idx_t)i * g->width + j;
                 res[idx].charge[b_idx] = g->charge[g_idx];
                 res[idx].bolt[b_idx] = g->reset_bolt[g_idx];
+                res[idx].choice_pos[b_idx] = -1;
                 b_idx++;
             }
         }
@@ -105,12 +134,30 @@ zonedef_t *generate_zones(graph_t *g, int process_count) {
     return res;
 }
 
+// only called by master
+// room for one more choice of the zone
+void grow_zonedef_choices(zonedef_t *zd) {
+    // a zone holds at most the frontier, whose count is an int
+    idx_t size = (idx_t)zd->width * zd->height;
+    idx_t max = zd->max_choice > 0 ? 2 * (idx_t)zd->max_choice : size / 64 + 16;
+    if (max > size)
+        max = size;
+    zd->max_choice = max < INT_MAX ? (int)max : INT_MAX;
+    zd->choice_idxs = realloc(zd->choice_idxs, (size_t)zd->max_choice * sizeof(idx_t));
+    zd->choice_idx_map = realloc(zd->choice_idx_map, (size_t)zd->max_choice * sizeof(int));
+    zd->probs = realloc(zd->probs, (size_t)zd->max_choice * sizeof(double));
+}
+
 void free_zonedef_list(zonedef_t *zonedef_list, int process_count) {
     int i;
     for (i = 0; i < process_count; i++) {
-        free(zonedef_list[i].charge);
-        free(zonedef_list[i].bolt);
+        free(zonedef_list[i].choice_idxs);
+        free(zonedef_list[i].choice_idx_map);
+        free(zonedef_list[i].probs);
+        MPI_Type_free(&zonedef_list[i].charge_row);
+        MPI_Type_free(&zonedef_list[i].bolt_row);
     }
+    free_arena(zonedef_list[0].arena);
     free(zonedef_list);
 }
 
@@ -118,7 +165,6 @@ void free_zonedef_list(zonedef_t *zonedef_list, int process_count) {
 // send data to zones
 void send_zone(graph_t *g, zonedef_t *zonedef_list, int zone_id) {
     int height = zonedef_list[zone_id].height;
-    int width = zonedef_list[zone_id].width;
     MPI_Request dummy_request;
     
     MPI_Isend(&g->height, 1, MPI_INT, zone_id, 0, MPI_COMM_WORLD, &dummy_request);
@@ -127,17 +173,18 @@ void send_zone(graph_t *g, zonedef_t *zonedef_list, int zone_id) {
     MPI_Isend(&zonedef_list[zone_id].start_col, 1, MPI_INT, zone_id, 0, MPI_COMM_WORLD, &dummy_request);
     MPI_Isend(&zonedef_list[zone_id].height, 1, MPI_INT, zone_id, 0, MPI_COMM_WORLD, &dummy_request);
     MPI_Isend(&zonedef_list[zone_id].width, 1, MPI_INT, zone_id, 0, MPI_COMM_WORLD, &dummy_request);
-    MPI_Isend(&zonedef_list[zone_id].eta, 1, MPI_INT, zone_id, 0, MPI_COMM_WORLD, &dummy_request);
+    MPI_Isend(&zonedef_list[zone_id].eta, 1, MPI_DOUBLE, zone_id, 0, MPI_COMM_WORLD, &dummy_request);
     MPI_Isend(zonedef_list[zone_id].adj, 4, MPI_INT, zone_id, 0, MPI_COMM_WORLD, &dummy_request);
-    MPI_Isend(zonedef_list[zone_id].charge, width * height, MPI_DOUBLE, zone_id, 0, MPI_COMM_WORLD, &dummy_request);
-    MPI_Isend(zonedef_list[zone_id].bolt, width * height, MPI_INT, zone_id, 0, MPI_COMM_WORLD, &dummy_request);
+    MPI_Isend(zonedef_list[zone_id].charge, height, zonedef_list[zone_id].charge_row, zone_id, 0, MPI_COMM_WORLD, &dummy_request);
+    MPI_Isend(zonedef_list[zone_id].bolt, height, zonedef_list[zone_id].bolt_row, zone_id, 0, MPI_COMM_WORLD, &dummy_request);
 }
 
 // called by all threads
 // get data of the zone from master process
 zone_t *setup_zone(int this_zone) {
     int gheight, gwidth;
-    int start_row, start_col, height, width, eta;
+    int start_row, start_col, height, width;
+    double eta;
     zone_t *zone = NULL;
     MPI_Recv(&gheight, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, NULL);
     MPI_Recv(&gwidth, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, NULL);
@@ -145,63 +192,34 @@ zone_t *setup_zone(int this_zone) {
     MPI_Recv(&start_col, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, NULL);
     MPI_Recv(&height, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, NULL);
     MPI_Recv(&width, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, NULL);
-    MPI_Recv(&eta, 1, MPI_INT, 0, 0, MPI_COMM_WORLD, NULL);
+    MPI_Recv(&eta, 1, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD, NULL);
     zone = new_zone(this_zone, gheight, gwidth, start_row, start_col, height, width, eta);
     MPI_Recv(zone->adj, 4, MPI_INT, 0, 0, MPI_COMM_WORLD, NULL);
-    MPI_Recv(zone->charge, height * width, MPI_DOUBLE, 0, 0, MPI_COMM_WORLD, NULL);
-    MPI_Recv(zone->reset_bolt, height * width, MPI_INT, 0, 0, MPI_COMM_WORLD, NULL);
+    MPI_Recv(zone->charge + zone->pitch + 1, 1, zone->zone_type, 0, 0, MPI_COMM_WORLD, NULL);
+    MPI_Recv(zone->reset_bolt, height, zone->bolt_row, 0, 0, MPI_COMM_WORLD, NULL);
 
     // printf("%d: %d %d %d %d %d %d %d %d %d\n", this_zone, start_row, start_col, height, width, eta, zone->adj[0], zone->adj[1], zone->adj[2], zone->adj[3]);
     return zone;
 }
 
-// y and x are in the zone, [-1, height], [-1, width]
-double get_charge(zone_t *z, int y, int x) {
-    int height = z->height;
-    int width = z->width;
-
-    if (x >= 0 && x < width &&
-        y >= 0 && y < height) {
-        return z->charge[y * width + x];
-    }
-
-    if (y < 0) {
-        if (z->adj[0] == -1)
-            return 0;
-        // ghost up row
-        return z->ghost_charge[x];
-    }
-
-    if (x < 0) {
-        if (z->adj[1] == -1)
-            return 0;
-        // ghost left col
-        return z->ghost_charge[width + y];
-    }
-
-    if (x >= width) {
-        if (z->adj[2] == -1)
-            return 0;
-        // ghost right col
-        return z->ghost_charge[width + height + y];
-    }
-
-    if (y >= height) {
-        if (z->adj[3] == -1)
-            return 0;
-        // ghost down row
-        return z->ghost_charge[width + height + height + x];
-    }
-
-    // never reach here
-    return 0.0;
+void free_zone(zone_t *z) {
+    free_arena(z->arena);
+    free(z->choice_idxs);
+    free(z->prob_buf);
+    MPI_Type_free(&z->col_type);
+    MPI_Type_free(&z->zone_type);
+    MPI_Type_free(&z->bolt_row);
+    free(z);
 }
 
 // exchange charges between zones
+// the edge cells of the neighbors land in the ghost cells of charge,
+// the ghost cells of the graph edges stay 0
 void exchange_charge(zone_t *z) {
     int i;
     int width = z->width;
     int height = z->height;
+    int pitch = z->pitch;
     MPI_Request send_r[4];
     MPI_Request recv_r[4];
 
@@ -209,40 +227,34 @@ void exchange_charge(zone_t *z) {
     // send charges
     if (z->adj[0] != -1) {
         // send to up
-        MPI_Isend(z->charge, width, MPI_DOUBLE, z->adj[0], 1, MPI_COMM_WORLD, &send_r[0]);
+        MPI_Isend(z->charge + pitch + 1, width, MPI_REAL_T, z->adj[0], 1, MPI_COMM_WORLD, &send_r[0]);
     }
     if (z->adj[1] != -1) {
         // send to left
-        for (i = 0; i < height; i++) {
-            z->left_buf[i] = z->charge[i * width];
-        }
-        MPI_Isend(z->left_buf, height, MPI_DOUBLE, z->adj[1], 1, MPI_COMM_WORLD, &send_r[1]);
+        MPI_Isend(z->charge + pitch + 1, 1, z->col_type, z->adj[1], 1, MPI_COMM_WORLD, &send_r[1]);
     }
     if (z->adj[2] != -1) {
         // send to right
-        for (i = 0; i < height; i++) {
-            z->right_buf[i] = z->charge[i * width + width - 1];
-        }
-        MPI_Isend(z->right_buf, height, MPI_DOUBLE, z->adj[2], 1, MPI_COMM_WORLD, &send_r[2]);
+        MPI_Isend(z->charge + pitch + width, 1, z->col_type, z->adj[2], 1, MPI_COMM_WORLD, &send_r[2]);
     }
     if (z->adj[3] != -1) {
         // send to down
-        MPI_Isend(z->charge + (height - 1) * width, width, MPI_DOUBLE, z->adj[3], 1, MPI_COMM_WORLD, &send_r[3]);
+        MPI_Isend(z->charge + height * pitch + 1, width, MPI_REAL_T, z->adj[3], 1, MPI_COMM_WORLD, &send_r[3]);
     }
 
     // receive charges
     if (z->adj[0] != -1) {
         // receive up
-        MPI_Irecv(z->ghost_charge, width, MPI_DOUBLE, z->adj[0], 1, MPI_COMM_WORLD, &recv_r[0]);
+        MPI_Irecv(z->charge + 1, width, MPI_REAL_T, z->adj[0], 1, MPI_COMM_WORLD, &recv_r[0]);
     }
     if (z->adj[1] != -1) {
-        MPI_Irecv(z->ghost_charge + width, height, MPI_DOUBLE, z->adj[1], 1, MPI_COMM_WORLD, &recv_r[1]);
+        MPI_Irecv(z->charge + pitch, 1, z->col_type, z->adj[1], 1, MPI_COMM_WORLD, &recv_r[1]);
     }
     if (z->adj[2] != -1) {
-        MPI_Irecv(z->ghost_charge + width + height, height, MPI_DOUBLE, z->adj[2], 1, MPI_COMM_WORLD, &recv_r[2]);
+        MPI_Irecv(z->charge + pitch + width + 1, 1, z->col_type, z->adj[2], 1, MPI_COMM_WORLD, &recv_r[2]);
     }
     if (z->adj[3] != -1) {
-        MPI_Irecv(z->ghost_charge + width + height + height, width, MPI_DOUBLE, z->adj[3], 1, MPI_COMM_WORLD, &recv_r[3]);
+        MPI_Irecv(z->charge + (height + 1) * pitch + 1, width, MPI_REAL_T, z->adj[3], 1, MPI_COMM_WORLD, &recv_r[3]);
     }
 
     // wait send recv finish
@@ -262,7 +274,8 @@ void scatter_power(int *power) {
 }
 
 void scatter_bolt(int process_count, bool mpi_master, graph_t *g, zonedef_t *zlist, zone_t *z) {
-    int i, j, idx, g_idx, b_idx;
+    int i, j, idx;
+    idx_t g_idx, b_idx;
 
     START_ACTIVITY(ACTIVITY_COMM);
     if (mpi_master) {
@@ -274,16 +287,19 @@ void scatter_bolt(int process_count, bool mpi_master, graph_t *g, zonedef_t *zli
             b_idx = 0;
             for (i = start_row; i < start_row + height; i++) {
                 for (j = start_col; j < start_col + width; j++) {
-                    g_idx = i * g->width + j;
+                    g_idx = (idx_t)i * g->width + j;
                     zlist[idx].bolt[b_idx] = g->bolt[g_idx];
                     b_idx++;
                 }
             }
-            MPI_Isend(zlist[idx].bolt, width * height, MPI_INT, idx, 3, MPI_COMM_WORLD, &zlist[idx].mpi_r);
+            MPI_Isend(zlist[idx].bolt, height, zlist[idx].bolt_row, idx, 3, MPI_COMM_WORLD, &zlist[idx].mpi_r);
         }
     }
 
-    MPI_Recv(z->bolt, z->width * z->height, MPI_INT, 0, 3, MPI_COMM_WORLD, NULL);
+    MPI_Recv(z->bolt, z->height, z->bolt_row, 0, 3, MPI_COMM_WORLD, NULL);
+    for (b_idx = 0; b_idx < (idx_t)z->width * z->height; b_idx++) {
+        z->dirichlet[b_idx] = dirichlet_value(z->bolt[b_idx]);
+    }
 
     if (mpi_master) {
         for (idx = 0; idx < process_count; idx++) {
@@ -300,14 +316,20 @@ void scatter_choices(int process_count, bool mpi_master, graph_t *g, zonedef_t *
     START_ACTIVITY(ACTIVITY_COMM);
     if (mpi_master) {
         for (zid = 0; zid < process_count; zid++) {
-            MPI_Isend(zlist[zid].choice_idxs, zlist[zid].num_choice, MPI_INT, zid, 3, MPI_COMM_WORLD, &zlist[zid].mpi_r);
+            MPI_Isend(zlist[zid].choice_idxs, zlist[zid].num_choice, MPI_IDX_T, zid, 3, MPI_COMM_WORLD, &zlist[zid].mpi_r);
         }
     }
 
-    int width = z->width;
-    int height = z->height;
-    MPI_Recv(z->choice_idxs, width * height, MPI_INT, 0, 3, MPI_COMM_WORLD, &status);
-    MPI_Get_count(&status, MPI_INT, &z->num_choice);
+    // the lists double until the received frontier fits
+    MPI_Probe(0, 3, MPI_COMM_WORLD, &status);
+    MPI_Get_count(&status, MPI_IDX_T, &z->num_choice);
+    if (z->num_choice > z->max_choice) {
+        while (z->max_choice < z->num_choice)
+            z->max_choice = z->max_choice > 0 ? 2 * z->max_choice : 16;
+        z->choice_idxs = (idx_t*)realloc(z->choice_idxs, (size_t)z->max_choice * sizeof(idx_t));
+        z->prob_buf = (double*)realloc(z->prob_buf, (size_t)z->max_choice * sizeof(double));
+    }
+    MPI_Recv(z->choice_idxs, z->num_choice, MPI_IDX_T, 0, 3, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
 
     if (mpi_master) {
         for (zid = 0; zid < process_count; zid++) {
@@ -343,15 +365,16 @@ void gather_probs(int process_count, bool mpi_master, graph_t *g, zonedef_t *zli
 
 void gather_charge(int process_count, bool mpi_master, graph_t *g, zonedef_t *zlist, zone_t *z) {
     MPI_Request r;
-    int b_idx, g_idx, idx;
+    idx_t b_idx, g_idx;
+    int idx;
 
     START_ACTIVITY(ACTIVITY_COMM);
     // send charge to master
-    MPI_Isend(z->charge, z->width * z->height, MPI_DOUBLE, 0, 3, MPI_COMM_WORLD, &r);
+    MPI_Isend(z->charge + z->pitch + 1, 1, z->zone_type, 0, 3, MPI_COMM_WORLD, &r);
     if (mpi_master) {
         // gather charge from all zones
         for (idx = 0; idx < process_count; idx++) {
-            MPI_Irecv(zlist[idx].charge, zlist[idx].width * zlist[idx].height, MPI_DOUBLE, idx, 3, MPI_COMM_WORLD, &zlist[idx].mpi_r);
+            MPI_Irecv(zlist[idx].charge, zlist[idx].height, zlist[idx].charge_row, idx, 3, MPI_COMM_WORLD, &zlist[idx].mpi_r);
         }
 
         // store data in zlist's buffer and set charge in graph
@@ -361,7 +384,7 @@ void gather_charge(int process_count, bool mpi_master, graph_t *g, zonedef_t *zl
             int width = zlist[idx].width;
             int height = zlist[idx].height;
             MPI_Wait(&zlist[idx].mpi_r, MPI_STATUS_IGNORE);
-            for (b_idx = 0; b_idx < height * width; b_idx++) {
+            for (b_idx = 0; b_idx < (idx_t)height * width; b_idx++) {
                 g_idx = ((b_idx / width) + start_row) * g->width + (b_idx % width) + start_col;
                 g->charge[g_idx] = zlist[idx].charge[b_idx];
             }
@@ -3,6 +3,23 @@
 #include <mpi.h>
 #include "graph.h"
 
+/* MPI type of the field, see real_t */
+#if FLOAT_FIELD
+#define MPI_REAL_T MPI_FLOAT
+#else
+#define MPI_REAL_T MPI_DOUBLE
+#endif
+
+/* MPI type of bolt_t */
+#define MPI_BOLT_T MPI_SHORT
+
+/* MPI type of idx_t */
+#if INDEX_BITS == 64
+#define MPI_IDX_T MPI_INT64_T
+#else
+#define MPI_IDX_T MPI_INT
+#endif
+
 typedef struct {
     int this_zone; // never used
 
@@ -13,27 +30,33 @@ typedef struct {
     int start_col;
     int width;
     int height;
-    int eta; // shape of lightning
+    double eta; // shape of lightning
     int adj[4]; // zoneid of up, left, right, down used in exchange charges
 
     int power; // used in scatter power
 
-    // electrical potential
-    double *charge;
-    double *charge_buffer;
-    double *ghost_charge;
+    arena_t *arena; // the buffers of the zone's size
+
+    // electrical potential, padded with one ghost cell per side,
+    // halos of the neighbor zones are received into the ghost cells
+    int pitch; // width + 2
+    real_t *charge;
+    real_t *charge_buffer;
+    real_t *dirichlet; // potential of bolt cells, negative for free cells
 
     // charge density (poisson equation)
-    double *boundary;
+    real_t *boundary;
 
-    int *reset_bolt;
-    int *bolt;
+    bolt_t *reset_bolt;
+    bolt_t *bolt;
     int num_choice;
-    int *choice_idxs; // choosed point, zoneidx
+    int max_choice; // entries of choice_idxs and prob_buf, grown on receive
+    idx_t *choice_idxs; // choosed point, zoneidx
 
     // MPI buffer
-    double *left_buf; // send buf used in exchange charge
-    double *right_buf; // send buf used in exchange charge
+    MPI_Datatype col_type; // a column of the padded field
+    MPI_Datatype zone_type; // the cells of the padded field
+    MPI_Datatype bolt_row; // a row of bolt, zones go row by row so counts stay int
     double *prob_buf; // send buf used in gatter_probs
     MPI_Request mpi_r;
 }zone_t;
@@ -43,24 +66,34 @@ typedef struct {
     int start_col;
     int width;
     int height;
-    int eta;
+    double eta;
     int adj[4]; // zoneid of up, left, right, down
-    double *charge; // used for setup_zone, gather_charge
-    int *bolt; // used for setup_zone, scatter_bolt
-    double *boundary; // used for scatter_boundary
+    arena_t *arena; // charge, bolt and choice_pos of every zone of the list
+    real_t *charge; // used for setup_zone, gather_charge
+    bolt_t *bolt; // used for setup_zone, scatter_bolt
 
     int num_choice; // used for scatter_choice, gather_probs
-    int *choice_idxs; // used for scatter_choice
+    int max_choice; // entries of the choice lists, grown with the frontier
+    idx_t *choice_idxs; // used for scatter_choice
     int *choice_idx_map; // used for gather_probs, map to g->choice_idxs's index
+    int *choice_pos; // slot of each zone cell in choice_idxs, -1 if none
     double *probs; // used for gather_probs
+    MPI_Datatype charge_row; // a row of charge
+    MPI_Datatype bolt_row; // a row of bolt
     MPI_Request mpi_r;
 }zonedef_t;
 
 zonedef_t *generate_zones(graph_t *g, int process_count);
+void grow_zonedef_choices(zonedef_t *zd);
 void send_zone(graph_t *g, zonedef_t *zonedef_list, int zone_id);
 zone_t *setup_zone(int this_zone);
+void free_zone(zone_t *z);
+
+// charge of cell idx (unpadded index) of the zone
+static inline real_t zone_charge(zone_t *z, idx_t idx) {
+    return z->charge[(idx / z->width + 1) * z->pitch + idx % z->width + 1];
+}
 
-double get_charge(zone_t *z, int y, int x);
 void exchange_charge(zone_t *z);
 void scatter_power(int *power);
 void scatter_bolt(int process_count, bool mpi_master, graph_t *g, zonedef_t *zlist, zone_t *z);
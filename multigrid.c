@@ -0,0 +1,309 @@
+#include <stdlib.h>
+#include <math.h>
+#include "graph.h"
+#include "multigrid.h"
+
+#if OMP
+#define OMP_FOR _Pragma("omp for schedule(static)")
+#define OMP_FOR_RESIDUAL _Pragma("omp for schedule(static) reduction(max:last_residual)")
+#define OMP_SINGLE _Pragma("omp single")
+#define OMP_BARRIER _Pragma("omp barrier")
+#else
+#define OMP_FOR
+#define OMP_FOR_RESIDUAL
+#define OMP_SINGLE
+#define OMP_BARRIER
+#endif
+
+/* Stop coarsening once a side is this short */
+#define MIN_SIDE 4
+/* Red-black Gauss-Seidel sweeps around the coarse grid correction */
+#define PRE_SMOOTH 2
+#define POST_SMOOTH 2
+/* Coarse grid visits per cycle, 1 for V-cycles, 2 for W-cycles.
+   A coarse cell is fixed as soon as one child is, which makes plain
+   V-cycles slow down as the graph grows */
+#define CYCLE_INDEX 2
+/* Cycles per level during full multigrid */
+#define FMG_CYCLES 1
+
+/* Max residual of the last smoothing sweep, shared by the team */
+static double last_residual;
+
+multigrid_t *new_multigrid(graph_t *g) {
+    multigrid_t *mg = (multigrid_t*)malloc(sizeof(multigrid_t));
+    int width = g->width;
+    int height = g->height;
+    size_t size = 0;
+    int l;
+    if (mg == NULL)
+        return NULL;
+
+    mg->num_level = 1;
+    for (;;) {
+        size_t cells = (size_t)width * height;
+        if (mg->num_level > 1)
+            size += 2 * arena_span(cells * sizeof(real_t));
+        size += arena_span(cells * sizeof(real_t)) + arena_span(cells);
+        if (width < 2 * MIN_SIDE || height < 2 * MIN_SIDE)
+            break;
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        mg->num_level++;
+    }
+    mg->level = (mg_level_t*)calloc(mg->num_level, sizeof(mg_level_t));
+    mg->arena = new_arena(size);
+
+    width = g->width;
+    height = g->height;
+    for (l = 0; l < mg->num_level; l++) {
+        mg_level_t *lv = &mg->level[l];
+        lv->width = width;
+        lv->height = height;
+        if (l == 0) {
+            lv->u = g->charge;
+            lv->rhs = g->boundary;
+        } else {
+            lv->u = (real_t*)arena_alloc(mg->arena, (size_t)width * height * sizeof(real_t));
+            lv->rhs = (real_t*)arena_alloc(mg->arena, (size_t)width * height * sizeof(real_t));
+        }
+        lv->res = (real_t*)arena_alloc(mg->arena, (size_t)width * height * sizeof(real_t));
+        lv->fixed = (unsigned char*)arena_alloc(mg->arena, (size_t)width * height * sizeof(unsigned char));
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+    return mg;
+}
+
+void free_multigrid(multigrid_t *mg) {
+    free_arena(mg->arena);
+    free(mg->level);
+    free(mg);
+}
+
+// value of u at (i, j), zero outside of the graph
+static inline double level_at(mg_level_t *lv, int i, int j) {
+    if (i < 0 || i >= lv->height || j < 0 || j >= lv->width)
+        return 0.0;
+    return lv->u[(idx_t)i * lv->width + j];
+}
+
+// red-black gauss-seidel on the free cells
+// returns the max residual met during the last sweep
+static double smooth(mg_level_t *lv, int sweeps) {
+    int width = lv->width;
+    int height = lv->height;
+    int s, color;
+    double residual;
+    OMP_SINGLE
+    last_residual = 0.0;
+    for (s = 0; s < sweeps; s++) {
+        for (color = 0; color < 2; color++) {
+            int i;
+            OMP_FOR_RESIDUAL
+            for (i = 0; i < height; i++) {
+                int j;
+                for (j = (i + color) & 1; j < width; j += 2) {
+                    idx_t idx = (idx_t)i * width + j;
+                    double sum;
+                    if (lv->fixed[idx])
+                        continue;
+                    sum = lv->rhs[idx];
+                    if (i > 0)
+                        sum += lv->u[idx - width];
+                    if (i < height - 1)
+                        sum += lv->u[idx + width];
+                    if (j > 0)
+                        sum += lv->u[idx - 1];
+                    if (j < width - 1)
+                        sum += lv->u[idx + 1];
+                    if (s == sweeps - 1)
+                        last_residual = fmax(last_residual, fabs(sum - 4 * lv->u[idx]));
+                    lv->u[idx] = sum / 4;
+                }
+            }
+        }
+    }
+    residual = last_residual;
+    // nobody may reset last_residual before every thread has read it
+    OMP_BARRIER
+    return residual;
+}
+
+// res = rhs + neighbor's u - 4 * u
+static void residual(mg_level_t *lv) {
+    int width = lv->width;
+    int height = lv->height;
+    int i;
+    OMP_FOR
+    for (i = 0; i < height; i++) {
+        int j;
+        for (j = 0; j < width; j++) {
+            idx_t idx = (idx_t)i * width + j;
+            double sum;
+            if (lv->fixed[idx]) {
+                lv->res[idx] = 0.0;
+                continue;
+            }
+            sum = lv->rhs[idx] - 4 * lv->u[idx];
+            if (i > 0)
+                sum += lv->u[idx - width];
+            if (i < height - 1)
+                sum += lv->u[idx + width];
+            if (j > 0)
+                sum += lv->u[idx - 1];
+            if (j < width - 1)
+                sum += lv->u[idx + 1];
+            lv->res[idx] = sum;
+        }
+    }
+}
+
+// average the 2x2 children of every coarse cell into the coarse rhs,
+// the coarse grid has twice the spacing, so the rhs is scaled by 4
+static void restrict_residual(mg_level_t *fine, mg_level_t *coarse) {
+    int i;
+    OMP_FOR
+    for (i = 0; i < coarse->height; i++) {
+        int j, di, dj;
+        for (j = 0; j < coarse->width; j++) {
+            idx_t idx = (idx_t)i * coarse->width + j;
+            double sum = 0.0;
+            int n = 0;
+            for (di = 0; di < 2; di++) {
+                for (dj = 0; dj < 2; dj++) {
+                    int fi = 2 * i + di;
+                    int fj = 2 * j + dj;
+                    if (fi < fine->height && fj < fine->width) {
+                        sum += fine->res[(idx_t)fi * fine->width + fj];
+                        n++;
+                    }
+                }
+            }
+            coarse->rhs[idx] = coarse->fixed[idx] ? 0.0 : 4 * sum / n;
+            coarse->u[idx] = 0.0;
+        }
+    }
+}
+
+// bilinear interpolation of the coarse u at fine cell (i, j)
+static inline double interpolate(mg_level_t *coarse, int i, int j) {
+    int ci = i / 2;
+    int cj = j / 2;
+    int ni = (i & 1) ? ci + 1 : ci - 1;
+    int nj = (j & 1) ? cj + 1 : cj - 1;
+    return (9 * level_at(coarse, ci, cj) + 3 * level_at(coarse, ni, cj) +
+            3 * level_at(coarse, ci, nj) + level_at(coarse, ni, nj)) / 16;
+}
+
+// add (or assign when fmg) the coarse u to the free cells of fine
+static void prolong(mg_level_t *coarse, mg_level_t *fine, int fmg) {
+    int i;
+    OMP_FOR
+    for (i = 0; i < fine->height; i++) {
+        int j;
+        for (j = 0; j < fine->width; j++) {
+            idx_t idx = (idx_t)i * fine->width + j;
+            if (fine->fixed[idx])
+                continue;
+            if (fmg) {
+                fine->u[idx] = interpolate(coarse, i, j);
+            } else {
+                fine->u[idx] += interpolate(coarse, i, j);
+            }
+        }
+    }
+}
+
+// mark dirichlet cells on every level, a coarse cell is fixed if any
+// child is. with fmg the source term and the fixed potential are also
+// carried down, so every level holds the full problem
+static void update_levels(multigrid_t *mg, graph_t *g, int fmg) {
+    mg_level_t *lv = &mg->level[0];
+    idx_t c;
+    int l, i;
+    OMP_FOR
+    for (c = 0; c < graph_cells(g); c++) {
+        if (g->bolt[c] < 0) {
+            lv->fixed[c] = 1;
+            lv->u[c] = 1.0;
+        } else if (g->bolt[c] > 0) {
+            lv->fixed[c] = 1;
+            lv->u[c] = 0.0;
+        } else {
+            lv->fixed[c] = 0;
+        }
+    }
+
+    for (l = 1; l < mg->num_level; l++) {
+        mg_level_t *fine = &mg->level[l - 1];
+        mg_level_t *coarse = &mg->level[l];
+        OMP_FOR
+        for (i = 0; i < coarse->height; i++) {
+            int j, di, dj;
+            for (j = 0; j < coarse->width; j++) {
+                idx_t idx = (idx_t)i * coarse->width + j;
+                double rhs = 0.0, u = 0.0;
+                int n = 0, nfixed = 0;
+                for (di = 0; di < 2; di++) {
+                    for (dj = 0; dj < 2; dj++) {
+                        int fi = 2 * i + di;
+                        int fj = 2 * j + dj;
+                        idx_t fidx = (idx_t)fi * fine->width + fj;
+                        if (fi >= fine->height || fj >= fine->width)
+                            continue;
+                        n++;
+                        rhs += fine->rhs[fidx];
+                        if (fine->fixed[fidx]) {
+                            nfixed++;
+                            u += fine->u[fidx];
+                        }
+                    }
+                }
+                coarse->fixed[idx] = nfixed > 0;
+                if (fmg) {
+                    coarse->rhs[idx] = 4 * rhs / n;
+                    coarse->u[idx] = nfixed > 0 ? u / nfixed : 0.0;
+                }
+            }
+        }
+    }
+}
+
+// returns the residual of the last smoothing sweep on level l
+static double cycle(multigrid_t *mg, int l) {
+    mg_level_t *lv = &mg->level[l];
+    int c;
+    if (l == mg->num_level - 1) {
+        // coarsest level, just relax until information crosses it
+        return smooth(lv, lv->width + lv->height);
+    }
+    smooth(lv, PRE_SMOOTH);
+    residual(lv);
+    restrict_residual(lv, lv + 1);
+    for (c = 0; c < CYCLE_INDEX; c++) {
+        cycle(mg, l + 1);
+    }
+    prolong(lv + 1, lv, 0);
+    return smooth(lv, POST_SMOOTH);
+}
+
+// one multigrid cycle on the current bolt
+double mg_cycle(multigrid_t *mg, graph_t *g) {
+    update_levels(mg, g, 0);
+    return cycle(mg, 0);
+}
+
+// full multigrid, solve the coarsest level and interpolate upward,
+// used as warm start in place of the initial sweeps
+void mg_fmg(multigrid_t *mg, graph_t *g) {
+    int l, c;
+    update_levels(mg, g, 1);
+    cycle(mg, mg->num_level - 1);
+    for (l = mg->num_level - 2; l >= 0; l--) {
+        prolong(&mg->level[l + 1], &mg->level[l], 1);
+        for (c = 0; c < FMG_CYCLES; c++) {
+            cycle(mg, l);
+        }
+    }
+}
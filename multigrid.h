@@ -0,0 +1,33 @@
+#ifndef __MULTIGRID_H__
+#define __MULTIGRID_H__
+#include "graph.h"
+
+/*
+ Geometric multigrid for the potential field.
+ Level 0 works on g->charge and g->boundary directly, coarser levels
+ hold the correction of the level above.
+ With OMP the functions must be called by every thread of the team.
+ mg_cycle returns the max residual of its last smoothing sweep.
+*/
+
+typedef struct {
+    int width;
+    int height;
+    real_t *u; // potential on level 0, correction below
+    real_t *rhs; // source term
+    real_t *res; // residual
+    unsigned char *fixed; // dirichlet cells (bolt != 0 on level 0)
+} mg_level_t;
+
+typedef struct {
+    int num_level;
+    mg_level_t *level;
+    arena_t *arena; // buffers of every level but the graph's
+} multigrid_t;
+
+multigrid_t *new_multigrid(graph_t *g);
+void free_multigrid(multigrid_t *mg);
+double mg_cycle(multigrid_t *mg, graph_t *g);
+void mg_fmg(multigrid_t *mg, graph_t *g);
+
+#endif
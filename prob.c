@@ -0,0 +1,145 @@
+// without trapping math the clamps and the select of the exp / log
+// loop become blends and it vectorizes
+#pragma GCC optimize ("no-trapping-math")
+#include <float.h>
+#include <stdint.h>
+#include <string.h>
+#include "prob.h"
+
+static inline uint64_t double_bits(double x) {
+    uint64_t b;
+    memcpy(&b, &x, sizeof(b));
+    return b;
+}
+
+static inline double bits_double(uint64_t b) {
+    double x;
+    memcpy(&x, &b, sizeof(x));
+    return x;
+}
+
+static void prob_eta0(double *weight, int n, double eta) {
+    int k;
+    for (k = 0; k < n; k++) {
+        weight[k] = 1.0;
+    }
+}
+
+static void prob_eta1(double *weight, int n, double eta) {
+}
+
+static void prob_eta2(double *weight, int n, double eta) {
+    int k;
+    for (k = 0; k < n; k++) {
+        weight[k] = weight[k] * weight[k];
+    }
+}
+
+static void prob_eta3(double *weight, int n, double eta) {
+    int k;
+    for (k = 0; k < n; k++) {
+        weight[k] = weight[k] * weight[k] * weight[k];
+    }
+}
+
+static void prob_eta4(double *weight, int n, double eta) {
+    int k;
+    for (k = 0; k < n; k++) {
+        double x2 = weight[k] * weight[k];
+        weight[k] = x2 * x2;
+    }
+}
+
+/* sqrt(1/2), the log reduces x to m 2^e with m in [sqrt(1/2), sqrt(2)) */
+#define SQRT_HALF_BITS 0x3fe6a09e667f3bcdULL
+#define EXP_BITS(e) ((uint64_t)(e) << 52)
+#define EXP_MASK 0xfff0000000000000ULL
+/* adding 1.5 * 2^52 rounds to an integer held in the low mantissa bits */
+#define ROUND_SHIFT 6755399441055744.0
+#define LN2_HI 6.93147180369123816490e-01
+#define LN2_LO 1.90821492927058770002e-10
+#define INV_LN2 1.44269504088896338700e+00
+
+// the avx2 copy has no fma, so every cpu rounds the same way
+static inline __attribute__((always_inline)) void frac_loop(double *weight, int n, double eta) {
+    int k;
+    for (k = 0; k < n; k++) {
+        double x = weight[k];
+        uint64_t ix = double_bits(x);
+
+        // log(x) = e log(2) + log(m), with s = (m - 1) / (m + 1)
+        // log(m) = 2 (s + s^3 / 3 + s^5 / 5 + ...), s^2 < 0.03
+        uint64_t u = ix - SQRT_HALF_BITS + EXP_BITS(1023);
+        double e = bits_double(EXP_BITS(0x433) | (u >> 52)) - (4503599627370496.0 + 1023.0);
+        double m = bits_double(ix - (u & EXP_MASK) + EXP_BITS(1023));
+        double s = (m - 1.0) / (m + 1.0);
+        double s2 = s * s;
+        double p = 1.0 / 19;
+        p = p * s2 + 1.0 / 17;
+        p = p * s2 + 1.0 / 15;
+        p = p * s2 + 1.0 / 13;
+        p = p * s2 + 1.0 / 11;
+        p = p * s2 + 1.0 / 9;
+        p = p * s2 + 1.0 / 7;
+        p = p * s2 + 1.0 / 5;
+        p = p * s2 + 1.0 / 3;
+        p = p * s2 + 1.0;
+        double y = eta * (e * LN2_HI + (e * LN2_LO + 2.0 * s * p));
+
+        // exp(y) = 2^t exp(r), t = round(y / log(2)), |r| <= log(2) / 2
+        y = y < -708.0 ? -708.0 : y;
+        y = y > 709.0 ? 709.0 : y;
+        double t = y * INV_LN2 + ROUND_SHIFT;
+        uint64_t it = double_bits(t) - double_bits(ROUND_SHIFT);
+        t -= ROUND_SHIFT;
+        double r = (y - t * LN2_HI) - t * LN2_LO;
+        double q = 1.0 / 6227020800.0;
+        q = q * r + 1.0 / 479001600.0;
+        q = q * r + 1.0 / 39916800.0;
+        q = q * r + 1.0 / 3628800.0;
+        q = q * r + 1.0 / 362880.0;
+        q = q * r + 1.0 / 40320.0;
+        q = q * r + 1.0 / 5040.0;
+        q = q * r + 1.0 / 720.0;
+        q = q * r + 1.0 / 120.0;
+        q = q * r + 1.0 / 24.0;
+        q = q * r + 1.0 / 6.0;
+        q = q * r + 0.5;
+        q = q * r + 1.0;
+        q = q * r + 1.0;
+        double w = q * bits_double(EXP_BITS(it + 1023));
+
+        // the reduction needs a normal x, smaller charges weigh nothing
+        weight[k] = x >= DBL_MIN ? w : 0.0;
+    }
+}
+
+static void prob_frac(double *weight, int n, double eta) {
+    frac_loop(weight, n, eta);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void prob_frac_avx2(double *weight, int n, double eta) {
+    frac_loop(weight, n, eta);
+}
+#endif
+
+prob_kernel_t prob_kernel(double eta) {
+    if (eta == 0.0)
+        return prob_eta0;
+    if (eta == 1.0)
+        return prob_eta1;
+    if (eta == 2.0)
+        return prob_eta2;
+    if (eta == 3.0)
+        return prob_eta3;
+    if (eta == 4.0)
+        return prob_eta4;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? prob_frac_avx2 : prob_frac;
+#else
+    return prob_frac;
+#endif
+}
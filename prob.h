@@ -0,0 +1,24 @@
+#ifndef __PROB_H__
+#define __PROB_H__
+
+/*
+ Weight kernels of the frontier, for the n choices
+   weight[k] = weight[k] ^ eta
+ in place, the caller gathers the charge of the choices into weight
+ first. eta 0 .. 4 are multiply chains and eta 0 sets every weight to 1,
+ so the charge need not be gathered. Other eta (> 0) go through
+ exp(eta * log(x)) on bit tricks and polynomials, with no calls or
+ branches in the loop so it vectorizes, charges <= 0 weigh 0.
+*/
+
+typedef void (*prob_kernel_t)(double *weight, int n, double eta);
+
+// kernel of eta, picked once at startup
+prob_kernel_t prob_kernel(double eta);
+
+// the kernel of eta reads the gathered charge
+static inline int prob_needs_charge(double eta) {
+    return eta != 0.0;
+}
+
+#endif
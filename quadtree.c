@@ -0,0 +1,490 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "graph.h"
+#include "stencil.h"
+#include "quadtree.h"
+
+/* A node splits while a refined cell is within QT_MARGIN sides of it */
+#define QT_MARGIN 2
+/* Initial slots of the cell table, it is kept at most half full */
+#define QT_MIN_CELLS 1024
+
+static inline long cell_key(const quadtree_t *qt, int i, int j) {
+    return (long)i * qt->width + j;
+}
+
+static inline unsigned long hash_key(long key) {
+    return ((unsigned long)key * 0x9E3779B97F4A7C15UL) >> 32;
+}
+
+// slot of key, or the empty slot where it goes
+static qt_cell_t *find_slot(qt_cell_t *cell, int max_cell, long key) {
+    unsigned long mask = max_cell - 1;
+    unsigned long s = hash_key(key) & mask;
+    while (cell[s].key != -1 && cell[s].key != key)
+        s = (s + 1) & mask;
+    return &cell[s];
+}
+
+static qt_cell_t *new_cells(int max_cell) {
+    qt_cell_t *cell = (qt_cell_t*)malloc(max_cell * sizeof(qt_cell_t));
+    int k;
+    for (k = 0; k < max_cell; k++)
+        cell[k].key = -1;
+    return cell;
+}
+
+static void grow_cells(quadtree_t *qt) {
+    qt_cell_t *old = qt->cell;
+    int k;
+    qt->cell = new_cells(2 * qt->max_cell);
+    for (k = 0; k < qt->max_cell; k++) {
+        if (old[k].key != -1)
+            *find_slot(qt->cell, 2 * qt->max_cell, old[k].key) = old[k];
+    }
+    qt->max_cell *= 2;
+    free(old);
+}
+
+qt_cell_t *qt_cell(quadtree_t *qt, int i, int j, int create) {
+    long key = cell_key(qt, i, j);
+    qt_cell_t *c;
+    if (create && 2 * (qt->num_cell + 1) > qt->max_cell)
+        grow_cells(qt);
+    c = find_slot(qt->cell, qt->max_cell, key);
+    if (c->key == key)
+        return c;
+    if (!create)
+        return NULL;
+    c->key = key;
+    c->bolt = 0;
+    c->reset_bolt = 0;
+    c->path = -1;
+    c->choice = -1;
+    c->source = 0.0;
+    qt->num_cell++;
+    return c;
+}
+
+static void grow_leaves(quadtree_t *qt) {
+    int max = qt->max_leaf > 0 ? 2 * qt->max_leaf : 1024;
+    qt->leaf_node = (int*)realloc(qt->leaf_node, max * sizeof(int));
+    qt->u = (real_t*)realloc(qt->u, max * sizeof(real_t));
+    qt->src = (real_t*)realloc(qt->src, max * sizeof(real_t));
+    qt->fixed = (real_t*)realloc(qt->fixed, max * sizeof(real_t));
+    qt->diag = (real_t*)realloc(qt->diag, max * sizeof(real_t));
+    qt->adj_start = (int*)realloc(qt->adj_start, max * sizeof(int));
+    qt->adj_count = (int*)realloc(qt->adj_count, max * sizeof(int));
+    qt->adj_cap = (int*)realloc(qt->adj_cap, max * sizeof(int));
+    qt->max_leaf = max;
+}
+
+static int new_leaf(quadtree_t *qt, int n, real_t u) {
+    int a;
+    if (qt->num_leaf == qt->max_leaf)
+        grow_leaves(qt);
+    a = qt->num_leaf++;
+    qt->leaf_node[a] = n;
+    qt->u[a] = u;
+    qt->src[a] = 0.0;
+    qt->fixed[a] = -1.0;
+    qt->adj_count[a] = 0;
+    qt->adj_cap[a] = 0;
+    qt->node[n].leaf = a;
+    return a;
+}
+
+static int new_node(quadtree_t *qt, int row, int col, int size) {
+    qt_node_t *nd;
+    if (qt->num_node == qt->max_node) {
+        qt->max_node = qt->max_node > 0 ? 2 * qt->max_node : 1024;
+        qt->node = (qt_node_t*)realloc(qt->node, qt->max_node * sizeof(qt_node_t));
+    }
+    nd = &qt->node[qt->num_node];
+    nd->row = row;
+    nd->col = col;
+    nd->size = size;
+    nd->child = -1;
+    nd->leaf = -1;
+    return qt->num_node++;
+}
+
+static void split(quadtree_t *qt, int n, real_t u);
+static void set_faces(quadtree_t *qt, int a);
+
+// a node inside the graph becomes a leaf, one across the edge splits
+static void place_node(quadtree_t *qt, int n, real_t u) {
+    qt_node_t *nd = &qt->node[n];
+    if (nd->row >= qt->height || nd->col >= qt->width)
+        return;
+    if (nd->row + nd->size <= qt->height && nd->col + nd->size <= qt->width)
+        new_leaf(qt, n, u);
+    else
+        split(qt, n, u);
+}
+
+// split leaf n or an edge node, the children start at potential u.
+// Only cells away from bolt and charge are in leaves larger than one
+// cell, so the children of a leaf are free and without charge
+static void split(quadtree_t *qt, int n, real_t u) {
+    int half = qt->node[n].size / 2;
+    int child = qt->num_node;
+    int a = qt->node[n].leaf;
+    int *near;
+    int num_near, k;
+
+    for (k = 0; k < 4; k++) {
+        new_node(qt, qt->node[n].row + k / 2 * half, qt->node[n].col + k % 2 * half, half);
+    }
+    qt->node[n].child = child;
+    qt->node[n].leaf = -1;
+    if (a < 0) {
+        // a node across the graph edge while the mesh is built
+        for (k = 0; k < 4; k++) {
+            place_node(qt, child + k, u);
+        }
+        qt->mesh_dirty = 1;
+        return;
+    }
+
+    // the first child takes the index of the leaf
+    qt->leaf_node[a] = child;
+    qt->node[child].leaf = a;
+    for (k = 1; k < 4; k++) {
+        new_leaf(qt, child + k, u);
+    }
+    if (qt->mesh_dirty)
+        return;
+    num_near = qt->adj_count[a];
+    near = (int*)malloc(num_near * sizeof(int));
+    memcpy(near, qt->adj + qt->adj_start[a], num_near * sizeof(int));
+    for (k = 0; k < 4; k++) {
+        set_faces(qt, qt->node[child + k].leaf);
+    }
+    for (k = 0; k < num_near; k++) {
+        set_faces(qt, near[k]);
+    }
+    free(near);
+}
+
+// node holding cell (i, j)
+static int find_node(const quadtree_t *qt, int i, int j) {
+    int n = 0;
+    while (qt->node[n].child >= 0) {
+        const qt_node_t *nd = &qt->node[n];
+        int half = nd->size / 2;
+        n = nd->child + (i >= nd->row + half) * 2 + (j >= nd->col + half);
+    }
+    return n;
+}
+
+// chebyshev distance of cell (i, j) to the square of nd, 0 inside
+static int node_distance(const qt_node_t *nd, int i, int j) {
+    int di = i < nd->row ? nd->row - i : i >= nd->row + nd->size ? i - (nd->row + nd->size - 1) : 0;
+    int dj = j < nd->col ? nd->col - j : j >= nd->col + nd->size ? j - (nd->col + nd->size - 1) : 0;
+    return di > dj ? di : dj;
+}
+
+// split the leaves near cell (i, j) down to the grading of QT_MARGIN
+static void refine(quadtree_t *qt, int n, int i, int j) {
+    int k;
+    if (qt->node[n].size == 1 || node_distance(&qt->node[n], i, j) > QT_MARGIN * qt->node[n].size)
+        return;
+    if (qt->node[n].child < 0) {
+        // outside the graph
+        if (qt->node[n].leaf < 0)
+            return;
+        split(qt, n, qt->u[qt->node[n].leaf]);
+    }
+    for (k = 0; k < 4; k++) {
+        refine(qt, qt->node[n].child + k, i, j);
+    }
+}
+
+static void new_root(quadtree_t *qt) {
+    int size = 1;
+    while (size < qt->width || size < qt->height)
+        size *= 2;
+    qt->num_node = 0;
+    qt->num_leaf = 0;
+    new_node(qt, 0, 0, size);
+    place_node(qt, 0, 0.0);
+    qt->mesh_dirty = 1;
+}
+
+quadtree_t *new_quadtree(int width, int height) {
+    quadtree_t *qt = (quadtree_t*)calloc(1, sizeof(quadtree_t));
+    if (qt == NULL)
+        return NULL;
+    qt->width = width;
+    qt->height = height;
+    qt->max_cell = QT_MIN_CELLS;
+    qt->cell = new_cells(qt->max_cell);
+    new_root(qt);
+    return qt;
+}
+
+void free_quadtree(quadtree_t *qt) {
+    free(qt->node);
+    free(qt->leaf_node);
+    free(qt->u);
+    free(qt->src);
+    free(qt->fixed);
+    free(qt->adj_start);
+    free(qt->adj_count);
+    free(qt->adj_cap);
+    free(qt->adj);
+    free(qt->adj_w);
+    free(qt->diag);
+    free(qt->cell);
+    free(qt);
+}
+
+static void add_face(quadtree_t *qt, int a, int b, real_t w) {
+    if (qt->num_adj == qt->max_adj) {
+        qt->max_adj = qt->max_adj > 0 ? 2 * qt->max_adj : 4096;
+        qt->adj = (int*)realloc(qt->adj, qt->max_adj * sizeof(int));
+        qt->adj_w = (real_t*)realloc(qt->adj_w, qt->max_adj * sizeof(real_t));
+    }
+    qt->adj[qt->num_adj] = b;
+    qt->adj_w[qt->num_adj] = w;
+    qt->num_adj++;
+    qt->diag[a] += w;
+}
+
+// faces of leaf a with the len cells from (i, j) in direction (di, dj)
+// just outside one of its sides. Across a face of length L between
+// squares of side s and t the flux weight is L / ((s + t) / 2), the
+// dense stencil when every side is 1
+static void add_side(quadtree_t *qt, int a, int i, int j, int di, int dj, int len) {
+    int size = qt->node[qt->leaf_node[a]].size;
+    int p = 0;
+    if (i < 0 || i >= qt->height || j < 0 || j >= qt->width) {
+        // ghost cells of potential 0 beyond the graph edge
+        qt->diag[a] += len * 2.0 / (size + 1);
+        return;
+    }
+    while (p < len) {
+        const qt_node_t *nd = &qt->node[find_node(qt, i + di * p, j + dj * p)];
+        int end = di ? nd->row + nd->size - i : nd->col + nd->size - j;
+        int overlap = (end < len ? end : len) - p;
+        add_face(qt, a, nd->leaf, overlap * 2.0 / (size + nd->size));
+        p += overlap;
+    }
+}
+
+// faces of leaf a, written at the end of the face arrays and moved
+// back into its old place if they fit
+static void set_faces(quadtree_t *qt, int a) {
+    const qt_node_t *nd = &qt->node[qt->leaf_node[a]];
+    int row = nd->row;
+    int col = nd->col;
+    int size = nd->size;
+    int start = qt->num_adj;
+    int count;
+
+    qt->diag[a] = 0.0;
+    add_side(qt, a, row - 1, col, 0, 1, size);
+    add_side(qt, a, row, col - 1, 1, 0, size);
+    add_side(qt, a, row, col + size, 1, 0, size);
+    add_side(qt, a, row + size, col, 0, 1, size);
+    count = qt->num_adj - start;
+    if (count <= qt->adj_cap[a]) {
+        memmove(qt->adj + qt->adj_start[a], qt->adj + start, count * sizeof(int));
+        memmove(qt->adj_w + qt->adj_start[a], qt->adj_w + start, count * sizeof(real_t));
+        qt->num_adj = start;
+    } else {
+        qt->adj_start[a] = start;
+        qt->adj_cap[a] = count;
+    }
+    qt->adj_count[a] = count;
+}
+
+// fixed leaves, charge density and faces after the mesh changed
+static void update_mesh(quadtree_t *qt) {
+    int a, k;
+    for (a = 0; a < qt->num_leaf; a++) {
+        qt->src[a] = 0.0;
+        qt->fixed[a] = -1.0;
+    }
+    for (k = 0; k < qt->max_cell; k++) {
+        qt_cell_t *c = &qt->cell[k];
+        const qt_node_t *nd;
+        if (c->key == -1)
+            continue;
+        nd = &qt->node[find_node(qt, c->key / qt->width, c->key % qt->width)];
+        qt->src[nd->leaf] += c->source;
+        if (c->bolt != 0 && nd->size == 1) {
+            qt->fixed[nd->leaf] = dirichlet_value(c->bolt);
+            qt->u[nd->leaf] = qt->fixed[nd->leaf];
+        }
+    }
+
+    // packed, no room left between the leaves
+    qt->num_adj = 0;
+    for (a = 0; a < qt->num_leaf; a++) {
+        qt->adj_cap[a] = 0;
+        set_faces(qt, a);
+    }
+    qt->mesh_dirty = 0;
+}
+
+void qt_set_bolt(quadtree_t *qt, int i, int j, int bolt) {
+    const qt_node_t *nd;
+    qt_cell(qt, i, j, 1)->bolt = bolt;
+    refine(qt, 0, i, j);
+    nd = &qt->node[find_node(qt, i, j)];
+    if (nd->size == 1) {
+        qt->fixed[nd->leaf] = dirichlet_value(bolt);
+        if (bolt != 0)
+            qt->u[nd->leaf] = qt->fixed[nd->leaf];
+    }
+}
+
+void qt_reset(quadtree_t *qt) {
+    quadtree_t old = *qt;
+    int k, a;
+
+    // keep the reset bolts and the charged cells
+    qt->num_cell = 0;
+    qt->max_cell = QT_MIN_CELLS;
+    for (k = 0; k < old.max_cell; k++) {
+        if (old.cell[k].key != -1 && (old.cell[k].reset_bolt != 0 || old.cell[k].source != 0.0))
+            qt->num_cell++;
+    }
+    while (2 * qt->num_cell > qt->max_cell)
+        qt->max_cell *= 2;
+    qt->cell = new_cells(qt->max_cell);
+    for (k = 0; k < old.max_cell; k++) {
+        qt_cell_t *c = &old.cell[k];
+        if (c->key == -1 || (c->reset_bolt == 0 && c->source == 0.0))
+            continue;
+        c->bolt = c->reset_bolt;
+        c->path = -1;
+        c->choice = -1;
+        *find_slot(qt->cell, qt->max_cell, c->key) = *c;
+    }
+    free(old.cell);
+
+    // new mesh around them, the potential is sampled from the old one
+    qt->node = NULL;
+    qt->max_node = 0;
+    qt->leaf_node = NULL;
+    qt->u = qt->src = qt->fixed = qt->diag = NULL;
+    qt->adj_start = qt->adj_count = qt->adj_cap = NULL;
+    qt->max_leaf = 0;
+    new_root(qt);
+    for (k = 0; k < qt->max_cell; k++) {
+        if (qt->cell[k].key != -1)
+            refine(qt, 0, qt->cell[k].key / qt->width, qt->cell[k].key % qt->width);
+    }
+    for (a = 0; a < qt->num_leaf; a++) {
+        const qt_node_t *nd = &qt->node[qt->leaf_node[a]];
+        int n = find_node(&old, nd->row + nd->size / 2, nd->col + nd->size / 2);
+        qt->u[a] = old.u[old.node[n].leaf];
+    }
+    free(old.node);
+    free(old.leaf_node);
+    free(old.u);
+    free(old.src);
+    free(old.fixed);
+    free(old.diag);
+    free(old.adj_start);
+    free(old.adj_count);
+    free(old.adj_cap);
+}
+
+int qt_leaf(quadtree_t *qt, int i, int j) {
+    return qt->node[find_node(qt, i, j)].leaf;
+}
+
+real_t qt_charge(quadtree_t *qt, int i, int j) {
+    int a = qt->node[find_node(qt, i, j)].leaf;
+    return a >= 0 ? qt->u[a] : 0.0;
+}
+
+double qt_relax(quadtree_t *qt, double omega) {
+    double residual = 0.0;
+    int a, k;
+    if (qt->mesh_dirty)
+        update_mesh(qt);
+    for (a = 0; a < qt->num_leaf; a++) {
+        double sum, r;
+        if (qt->fixed[a] >= 0)
+            continue;
+        sum = qt->src[a];
+        for (k = qt->adj_start[a]; k < qt->adj_start[a] + qt->adj_count[a]; k++) {
+            sum += qt->adj_w[k] * qt->u[qt->adj[k]];
+        }
+        r = sum - qt->diag[a] * qt->u[a];
+        residual = fmax(residual, fabs(r));
+        qt->u[a] += omega * r / qt->diag[a];
+    }
+    return residual;
+}
+
+typedef struct {
+    long key;
+    int bolt;
+} bolt_cell_t;
+
+static int compare_key(const void *a, const void *b) {
+    long ka = ((const bolt_cell_t*)a)->key;
+    long kb = ((const bolt_cell_t*)b)->key;
+    return ka < kb ? -1 : ka > kb;
+}
+
+void qt_print(quadtree_t *qt, format_t format, FILE *outfile) {
+    bolt_cell_t *bolts = (bolt_cell_t*)malloc(qt->num_cell * sizeof(bolt_cell_t));
+    int *row = (int*)calloc(qt->width, sizeof(int));
+    gif_writer_t *gif = NULL;
+    int num = 0;
+    int i, k, first;
+
+    // the non-zero cells in row order, rasterized one row at a time
+    for (k = 0; k < qt->max_cell; k++) {
+        if (qt->cell[k].key != -1 && qt->cell[k].bolt != 0) {
+            bolts[num].key = qt->cell[k].key;
+            bolts[num].bolt = qt->cell[k].bolt;
+            num++;
+        }
+    }
+    qsort(bolts, num, sizeof(bolt_cell_t), compare_key);
+    if (format == FORMAT_BIN) {
+        bin_writer_t w;
+        bin_frame_begin(&w, outfile);
+        for (k = 0; k < num; k++) {
+            bin_frame_cell(&w, bolts[k].key, bolts[k].bolt);
+        }
+        bin_frame_end(&w);
+        free(bolts);
+        free(row);
+        return;
+    }
+    if (format == FORMAT_GIF) {
+        gif = (gif_writer_t*)malloc(sizeof(gif_writer_t));
+        gif_frame_begin(gif, outfile, qt->height, qt->width);
+    }
+    k = 0;
+    for (i = 0; i < qt->height; i++) {
+        for (first = k; k < num && bolts[k].key / qt->width == i; k++) {
+            row[bolts[k].key % qt->width] = bolts[k].bolt;
+        }
+        if (gif != NULL)
+            gif_frame_row(gif, row, qt->width);
+        else
+            print_row(row, qt->width, outfile);
+        for (; first < k; first++) {
+            row[bolts[first].key % qt->width] = 0;
+        }
+    }
+    if (gif != NULL) {
+        gif_frame_end(gif);
+        free(gif);
+    } else {
+        fprintf(outfile, "\n");
+    }
+    free(bolts);
+    free(row);
+}
@@ -0,0 +1,89 @@
+#ifndef __QUADTREE_H__
+#define __QUADTREE_H__
+#include <stdio.h>
+#include "graph.h"
+
+/*
+ Adaptive quadtree mesh of the potential field, for graphs too large
+ for the dense arrays of graph_t.
+ The root is the smallest power of 2 square covering the graph. A node
+ splits in 4 while a bolt cell or a cell with charge density lies
+ within QT_MARGIN node sides of it, so the mesh is single cells along
+ the bolts and grows by a factor 2 every QT_MARGIN cells away from
+ them. Nodes crossing the graph edge split until each is inside or
+ outside, only leaves inside the graph hold a potential, outside is 0
+ like the ghost cells of the dense solvers.
+ The bolt state lives in a hash table of the cells that are not plain
+ free cells, nothing is allocated per cell of the graph.
+*/
+
+typedef struct {
+    int row, col; // top left cell
+    int size; // side in cells
+    int child; // first of the 4 children, -1 for leaves
+    int leaf; // index of the leaf arrays, -1 outside the graph
+} qt_node_t;
+
+typedef struct {
+    long key; // row * width + col, -1 for an empty slot
+    int bolt;
+    int reset_bolt;
+    long path; // key of the bolt cell it grew from, -1 for none
+    int choice; // slot in the frontier of the solver, -1 if none
+    real_t source; // charge density (poisson equation)
+} qt_cell_t;
+
+typedef struct {
+    int width;
+    int height;
+
+    int num_node, max_node;
+    qt_node_t *node; // node 0 is the root
+
+    // per leaf, finite volume of the leaf square
+    int num_leaf, max_leaf;
+    int *leaf_node;
+    real_t *u; // potential
+    real_t *src; // charge density summed over the cells
+    real_t *fixed; // potential of bolt cells, negative for free leaves
+
+    // faces between leaves, rebuilt with the mesh, a split patches the
+    // faces of the new leaves and of their neighbors
+    int mesh_dirty;
+    int num_adj, max_adj;
+    int *adj_start; // first face of each leaf
+    int *adj_count;
+    int *adj_cap; // room at adj_start before the faces move to the end
+    int *adj; // leaf on the other side
+    real_t *adj_w; // face length / center distance
+    real_t *diag; // sum of the weights, outside faces included
+
+    int num_cell, max_cell; // max_cell is a power of 2
+    qt_cell_t *cell;
+} quadtree_t;
+
+quadtree_t *new_quadtree(int width, int height);
+void free_quadtree(quadtree_t *qt);
+
+// cell (i, j) of the table, added as a free cell if create is set,
+// NULL if it is not there. Adding may move the other cells.
+qt_cell_t *qt_cell(quadtree_t *qt, int i, int j, int create);
+// set the bolt of cell (i, j) and refine the mesh around it
+void qt_set_bolt(quadtree_t *qt, int i, int j, int bolt);
+// start a lightning: bolt = reset_bolt, no paths or choices, cells
+// that are neither reset bolts nor charged are dropped and the mesh is
+// rebuilt around the rest, the potential carries over
+void qt_reset(quadtree_t *qt);
+
+// leaf holding cell (i, j), the leaf of a single cell never changes
+// until qt_reset
+int qt_leaf(quadtree_t *qt, int i, int j);
+// potential of the leaf holding cell (i, j)
+real_t qt_charge(quadtree_t *qt, int i, int j);
+// one SOR sweep over the leaves, returns the max residual before it
+double qt_relax(quadtree_t *qt, double omega);
+
+// write the bolt as one frame of format, as print_frame does
+void qt_print(quadtree_t *qt, format_t format, FILE *outfile);
+
+#endif
@@ -0,0 +1,49 @@
+#include "rng.h"
+
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+#define PHILOX_ROUNDS 10
+
+void rng_init(rng_t *r, unsigned long seed, long lightning, long step) {
+    r->key[0] = (uint32_t)seed;
+    r->key[1] = (uint32_t)((uint64_t)seed >> 32);
+    r->ctr[0] = (uint32_t)lightning;
+    r->ctr[1] = (uint32_t)step;
+    r->ctr[2] = 0;
+    r->ctr[3] = 0;
+}
+
+// the 4 words of block ctr under key
+static void philox(const uint32_t key[2], const uint32_t ctr[4], uint32_t out[4]) {
+    uint32_t k0 = key[0], k1 = key[1];
+    uint32_t x0 = ctr[0], x1 = ctr[1], x2 = ctr[2], x3 = ctr[3];
+    int i;
+    for (i = 0; i < PHILOX_ROUNDS; i++) {
+        uint64_t p0 = (uint64_t)PHILOX_M0 * x0;
+        uint64_t p1 = (uint64_t)PHILOX_M1 * x2;
+        uint32_t y0 = (uint32_t)(p1 >> 32) ^ x1 ^ k0;
+        uint32_t y1 = (uint32_t)p1;
+        uint32_t y2 = (uint32_t)(p0 >> 32) ^ x3 ^ k1;
+        uint32_t y3 = (uint32_t)p0;
+        x0 = y0;
+        x1 = y1;
+        x2 = y2;
+        x3 = y3;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = x0;
+    out[1] = x1;
+    out[2] = x2;
+    out[3] = x3;
+}
+
+double rng_next(rng_t *r) {
+    uint32_t out[4];
+    philox(r->key, r->ctr, out);
+    r->ctr[2]++;
+    // 53 random bits
+    return ((out[0] >> 5) * 67108864.0 + (out[1] >> 6)) * (1.0 / 9007199254740992.0);
+}
@@ -0,0 +1,23 @@
+#ifndef __RNG_H__
+#define __RNG_H__
+#include <stdint.h>
+
+/*
+ Counter-based random numbers (Philox4x32-10).
+ A stream is keyed by the seed and starts at the counter (lightning,
+ step), draw k of the stream is a pure function of (seed, lightning,
+ step, k). No state is shared, so any thread or rank can draw any
+ number and gets the same one light-seq draws.
+*/
+
+typedef struct {
+    uint32_t key[2];
+    uint32_t ctr[4]; // lightning, step, draw, 0
+} rng_t;
+
+// stream of step `step` of lightning `lightning`
+void rng_init(rng_t *r, unsigned long seed, long lightning, long step);
+// next draw of the stream, uniform in [0, 1)
+double rng_next(rng_t *r);
+
+#endif
@@ -0,0 +1,118 @@
+#include <stdlib.h>
+#include "sampler.h"
+
+#if OMP
+#define OMP_FOR _Pragma("omp for schedule(static)")
+#define OMP_SINGLE _Pragma("omp single")
+#else
+#define OMP_FOR
+#define OMP_SINGLE
+#endif
+
+static inline int lowbit(int j) {
+    return j & -j;
+}
+
+static inline double clamp(double weight) {
+    return weight > 0.0 ? weight : 0.0;
+}
+
+sampler_t *new_sampler(void) {
+    sampler_t *s = (sampler_t*)calloc(1, sizeof(sampler_t));
+    return s;
+}
+
+void free_sampler(sampler_t *s) {
+    if (s == NULL)
+        return;
+    free(s->weight);
+    free(s->tree);
+    free(s);
+}
+
+static void grow(sampler_t *s, int n) {
+    if (n <= s->max)
+        return;
+    while (s->max < n)
+        s->max = s->max > 0 ? 2 * s->max : 1024;
+    s->weight = (double*)realloc(s->weight, s->max * sizeof(double));
+    s->tree = (double*)realloc(s->tree, (s->max + 1) * sizeof(double));
+}
+
+void sampler_build(sampler_t *s, const double *weight, int n) {
+    int j, half;
+
+    OMP_SINGLE
+    {
+        grow(s, n);
+        s->size = n;
+    }
+    // lowbit 1, a single weight
+    OMP_FOR
+    for (j = 1; j <= n; j++) {
+        s->weight[j - 1] = clamp(weight[j - 1]);
+        if (j & 1)
+            s->tree[j] = s->weight[j - 1];
+    }
+    // lowbit 2 * half, its own weight and the nodes of its children
+    for (half = 1; 2 * half <= n; half *= 2) {
+        OMP_FOR
+        for (j = 2 * half; j <= n; j += 4 * half) {
+            double sum = s->weight[j - 1];
+            int c;
+            for (c = half; c > 0; c /= 2) {
+                sum += s->tree[j - c];
+            }
+            s->tree[j] = sum;
+        }
+    }
+}
+
+void sampler_update(sampler_t *s, int i, double weight) {
+    double delta;
+    int j;
+    weight = clamp(weight);
+    delta = weight - s->weight[i];
+    s->weight[i] = weight;
+    for (j = i + 1; j <= s->size; j += lowbit(j)) {
+        s->tree[j] += delta;
+    }
+}
+
+double sampler_total(const sampler_t *s) {
+    double sum = 0.0;
+    int j;
+    for (j = s->size; j > 0; j -= lowbit(j)) {
+        sum += s->tree[j];
+    }
+    return sum;
+}
+
+int sampler_draw(const sampler_t *s, double target) {
+    int pos = 0;
+    int step = 1;
+    if (s->size == 0)
+        return -1;
+    while (2 * step <= s->size)
+        step *= 2;
+    // largest pos whose prefix sum is not above target
+    for (; step > 0; step /= 2) {
+        if (pos + step <= s->size && s->tree[pos + step] <= target) {
+            pos += step;
+            target -= s->tree[pos];
+        }
+    }
+    if (pos == s->size)
+        pos = s->size - 1;
+    // rounding of the tree sums or a target at the total may land on a
+    // weight set to 0, take the closest one that is not
+    if (s->weight[pos] <= 0.0) {
+        int k;
+        for (k = pos + 1; k < s->size && s->weight[k] <= 0.0; k++);
+        if (k == s->size)
+            for (k = pos - 1; k >= 0 && s->weight[k] <= 0.0; k--);
+        if (k >= 0)
+            pos = k;
+    }
+    return pos;
+}
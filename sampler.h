@@ -0,0 +1,35 @@
+#ifndef __SAMPLER_H__
+#define __SAMPLER_H__
+
+/*
+ Weighted draw over the frontier, a Fenwick (binary indexed) tree over
+ the weights of choice 0 .. size - 1.
+ tree[j] (1-based) holds the weights of (j - lowbit(j), j], so a draw or
+ the change of one weight walks log2(size) nodes. Negative weights,
+ potentials that overshoot below 0, count as 0.
+ sampler_build rebuilds the whole tree in O(size) one level of lowbit
+ at a time, with OMP it must be called by every thread of the team and
+ sums the same on any number of threads.
+*/
+
+typedef struct {
+    int size; // weights in the tree
+    int max; // room of weight and tree
+    double *weight;
+    double *tree; // tree[0] is unused
+} sampler_t;
+
+sampler_t *new_sampler(void);
+void free_sampler(sampler_t *s);
+// rebuild from weight[0 .. n - 1] after a sweep changed all of them
+void sampler_build(sampler_t *s, const double *weight, int n);
+// set the weight of choice i
+void sampler_update(sampler_t *s, int i, double weight);
+// sum of all weights
+double sampler_total(const sampler_t *s);
+// first choice whose prefix sum is above target, the last one if none
+// is, never one of weight 0 while another has a weight, -1 if the
+// sampler is empty
+int sampler_draw(const sampler_t *s, double target);
+
+#endif
@@ -6,12 +6,13 @@
 #include <driver_functions.h>
 #include "sim.h"
 #include "instrument.h"
+#include "writer.h"
+#include "sampler.h"
+#include "rng.h"
 
 
 
 
-/* What is the crossover between binary and linear search */
-#define BINARY_THRESHOLD 4
 #define BLOCK_HEIGHT 16
 #define BLOCK_WIDTH 16
 #define BLOCK_SIZE (BLOCK_HEIGHT*BLOCK_WIDTH)
@@ -23,115 +24,112 @@ struct GlobalConstants {
 
     int width;
     int height;
-    int eta;
+    double eta;
 
     double *charge;
     double *charge_buffer;
 
     double *boundary;
-    int *bolt;
+    bolt_t *bolt;
 
     double* choice_probs;
-    int* choice_inv_map;
-    int* choosed;
+    int* choice_inv_map; // slot of the cell in choice_probs, -1 if none
 
 };
 
 __constant__ GlobalConstants cuConstGraph;
 GlobalConstants params;
 
-int *choice_map;
+/* Draws the next bolt among the choices */
+sampler_t *sampler;
 
-/*
-  Linear search
- */
-static inline int locate_value_linear(double target, double *list, int len) {
-    int i;
-    for (i = 0; i < len; i++)
-	    if (target < list[i])
-	        return i;
-    /* Shouldn't get here */
-    return -1;
-}
-
-/*
-  Binary search down to threshold, and then linear
- */
-static inline int locate_value(double target, double *list, int len) {
-    int left = 0;
-    int right = len-1;
-    while (left < right) {
-	    if (right-left+1 < BINARY_THRESHOLD)
-	        return left + locate_value_linear(target, list+left, right-left+1);
-	    int mid = left + (right-left)/2;
-	    if (target < list[mid])
-	        right = mid;
-	    else
-	        left = mid+1;
-    }
-    return right;
-}
 static void reset_charge(graph_t *g) {
-    int i;
-    for (i = 0; i < g->height * g->width; i++) {
+    idx_t i;
+    if (g->charge_buffer == NULL) {
+        g->charge_buffer = new_field(g->arena, g->height, g->width);
+    }
+    for (i = 0; i < graph_cells(g); i++) {
         g->charge[i] = g->charge_buffer[i] = 0;
     }
 }
 
 static void reset_boundary(graph_t *g) {
-    int i;
-    for (i = 0; i < g->height * g->width; i++) {
+    idx_t i;
+    for (i = 0; i < graph_cells(g); i++) {
         g->boundary[i] = 0.0;
     }
 }
 
 static void reset_bolt(graph_t *g) {
-    int i;
-    for (i = 0; i < g->height * g->width; i++) {
+    idx_t i;
+    for (i = 0; i < graph_cells(g); i++) {
         g->bolt[i] = g->reset_bolt[i];
     }
 }
 
-static void reset_path(graph_t *g) {
+// undo what the last lightning did to bolt and path, only its touched
+// cells differ from the reset state
+static void reset_touched(graph_t *g) {
     int i;
-    for (i = 0; i < g->height * g->width; i++) {
-        g->path[i] = -1;
+    idx_t idx;
+    for (i = 0; i < g->num_touched; i++) {
+        idx = g->touched_idxs[i];
+        g->bolt[idx] = g->reset_bolt[idx];
+        g->state[idx] = CELL_PATH_NONE;
     }
+    g->num_touched = 0;
 }
 
-static void choose_helper(graph_t *g, int bolt_idx, int i, int j) {
-    int idx = i * g->width + j;
-    if (i >= 0 && i < g->height && j >= 0 && j < g->width &&
-        g->choosed[idx] == 0 && g->bolt[idx] <= 0) {
-        g->choosed[idx] = 1;
+// path is the side of the bolt cell that reached (i, j)
+static void choose_helper(graph_t *g, int path, int i, int j) {
+    idx_t idx;
+    // the tile layout has no index for cells off the graph
+    if (i < 0 || i >= g->height || j < 0 || j >= g->width)
+        return;
+    idx = cell_index(g, i, j);
+    if (g->choice_pos[idx] == -1 && g->bolt[idx] <= 0) {
+        if (g->num_choice == g->max_choice)
+            grow_choices(g);
+        g->choice_pos[idx] = g->num_choice;
         g->choice_idxs[g->num_choice] = idx;
-        choice_map[idx] = g->num_choice;
         g->num_choice++;
-        g->path[idx] = bolt_idx;
+        touch_cell(g, idx);
+        g->state[idx] = (g->state[idx] & ~CELL_PATH_MASK) | path;
     }
 }
 
-static void find_choice(graph_t *g, int idx) {
+static void find_choice(graph_t *g, idx_t idx) {
     int i, j;
     if (g->bolt[idx] > 0) {
-        i = idx / g->width;
-        j = idx % g->width;
-        choose_helper(g, idx, i - 1, j);
-        choose_helper(g, idx, i, j - 1);
-        choose_helper(g, idx, i, j + 1);
-        choose_helper(g, idx, i + 1, j);
+        i = cell_row(g, idx);
+        j = cell_col(g, idx);
+        choose_helper(g, CELL_PATH_DOWN, i - 1, j);
+        choose_helper(g, CELL_PATH_RIGHT, i, j - 1);
+        choose_helper(g, CELL_PATH_LEFT, i, j + 1);
+        choose_helper(g, CELL_PATH_UP, i + 1, j);
     }
 }
 
+// drop the cell that became bolt, the last choice takes its slot
+static void remove_choice(graph_t *g, idx_t idx) {
+    int slot = g->choice_pos[idx];
+    idx_t last = g->choice_idxs[--g->num_choice];
+    g->choice_idxs[slot] = last;
+    g->choice_pos[last] = slot;
+    g->choice_pos[idx] = -1;
+    cudaMemcpy(&(params.choice_inv_map[last]), &(g->choice_pos[last]), sizeof(int), cudaMemcpyHostToDevice);
+    cudaMemcpy(&(params.choice_inv_map[idx]), &(g->choice_pos[idx]), sizeof(int), cudaMemcpyHostToDevice);
+}
+
 static void reset_choice(graph_t *g) {
     int i;
-    g->num_choice = 0;
-    for (i = 0; i < g->height * g->width; i++) {
-        g->choosed[i] = 0;
+    for (i = 0; i < g->num_choice; i++) {
+        g->choice_pos[g->choice_idxs[i]] = -1;
     }
-    // get choices idxs
-    for (i = 0; i < g->width * g->height; i++) {
-        find_choice(g, i);
+    g->num_choice = 0;
+    // get choices idxs around the reset bolts
+    for (i = 0; i < g->num_seed; i++) {
+        find_choice(g, g->seed_idxs[i]);
     }
 }
 
@@ -176,8 +174,8 @@ __global__ void kernel_update_value(){
             new_charge[linearThreadIndex] /= 4;
         }
         cuConstGraph.charge_buffer[globalIdx] = new_charge[linearThreadIndex];
-        if(cuConstGraph.choosed[globalIdx] == 1){
-            cuConstGraph.choice_probs[cuConstGraph.choice_inv_map[globalIdx]] = cuConstGraph.bolt[globalIdx] > 0 ? 0 : pow(new_charge[linearThreadIndex], cuConstGraph.eta);
+        if(cuConstGraph.choice_inv_map[globalIdx] >= 0){
+            cuConstGraph.choice_probs[cuConstGraph.choice_inv_map[globalIdx]] = pow(new_charge[linearThreadIndex], cuConstGraph.eta);
         }
     }
     __syncthreads();
@@ -231,34 +229,35 @@ static void update_boundary(graph_t *g){
 
 }
 // add charge to bolt along the path
-static void discharge(graph_t *g, int index, int charge) {
+static void discharge(graph_t *g, idx_t index, int charge) {
     int count = 500;
     while (index != -1 && count > 0) {
         count -= 1;
+        touch_cell(g, index);
         g->bolt[index] += charge;
-        cudaMemcpy(&(params.bolt[index]), &(g->bolt[index]), sizeof(int), cudaMemcpyHostToDevice);
-        index = g->path[index];
+        cudaMemcpy(&(params.bolt[index]), &(g->bolt[index]), sizeof(bolt_t), cudaMemcpyHostToDevice);
+        index = path_next(g, index);
     }
 }
 static __inline__ void update_kernel_choosed(graph_t *g, int i, int j){
-    int idx = i * g->width + j;
+    idx_t idx = cell_index(g, i, j);
     if(i >= 0 && i < g->height && j >= 0 && j < g->height && g->bolt[idx] <= 0){
-        cudaMemcpy(&(params.choosed[idx]), &(g->choosed[idx]), sizeof(int), cudaMemcpyHostToDevice);
-        cudaMemcpy(&(params.choice_inv_map[idx]), &(choice_map[idx]), sizeof(int), cudaMemcpyHostToDevice);
+        cudaMemcpy(&(params.choice_inv_map[idx]), &(g->choice_pos[idx]), sizeof(int), cudaMemcpyHostToDevice);
     }
 
 }
-static __inline__ void update_kernel_state(graph_t *g, int next_bolt){
-    cudaMemcpy(&(params.bolt[next_bolt]), &(g->bolt[next_bolt]), sizeof(int), cudaMemcpyHostToDevice);
-    int i = next_bolt / g->width;
-    int j = next_bolt % g->width;
+static __inline__ void update_kernel_state(graph_t *g, idx_t next_bolt){
+    cudaMemcpy(&(params.bolt[next_bolt]), &(g->bolt[next_bolt]), sizeof(bolt_t), cudaMemcpyHostToDevice);
+    int i = cell_row(g, next_bolt);
+    int j = cell_col(g, next_bolt);
     update_kernel_choosed(g, i-1, j);
     update_kernel_choosed(g, i+1, j);
     update_kernel_choosed(g, i, j-1);
     update_kernel_choosed(g, i, j+1);
 }
-static void find_next(graph_t *g, int* power) {
-    int idx, choice, next_bolt;
+static void find_next(graph_t *g, int* power, rng_t *rng) {
+    int choice;
+    idx_t next_bolt;
     double breach;
 
     START_ACTIVITY(ACTIVITY_COMM);
@@ -266,11 +265,9 @@ static void find_next(graph_t *g, int* power) {
     FINISH_ACTIVITY(ACTIVITY_COMM);
     // calculate probability based on latest charge
     START_ACTIVITY(ACTIVITY_NEXT);
-    for(idx = 1; idx < g->num_choice; idx++){
-        g->choice_probs[idx] += g->choice_probs[idx-1];
-    }
-    breach = (double)rand()/RAND_MAX * g->choice_probs[g->num_choice - 1];
-    choice = locate_value(breach, g->choice_probs, g->num_choice);
+    sampler_build(sampler, g->choice_probs, g->num_choice);
+    breach = rng_next(rng) * sampler_total(sampler);
+    choice = sampler_draw(sampler, breach);
     // choose one as bolt
     if (choice != -1){
         next_bolt = g->choice_idxs[choice];
@@ -279,6 +276,7 @@ static void find_next(graph_t *g, int* power) {
             discharge(g, next_bolt, -g->bolt[next_bolt]);
         }
         g->bolt[next_bolt] = 1;
+        remove_choice(g, next_bolt);
         find_choice(g, next_bolt);
         FINISH_ACTIVITY(ACTIVITY_NEXT);
 
@@ -292,25 +290,26 @@ static void find_next(graph_t *g, int* power) {
     
 }
 
-static void simulate_one(graph_t *g) {
+static void simulate_one(graph_t *g, long lightning) {
     int power = g->power;
-    int graphSize = g->width*g->height;
+    long step = 0;
+    rng_t rng;
+    size_t graphSize = graph_cells(g);
 
 
     START_ACTIVITY(ACTIVITY_RECOVER);
-    reset_bolt(g);
-    reset_path(g);
+    reset_touched(g);
     reset_choice(g);
     FINISH_ACTIVITY(ACTIVITY_RECOVER);
     START_ACTIVITY(ACTIVITY_COMM);
-    cudaMemcpy(params.bolt, g->bolt, sizeof(int)*graphSize, cudaMemcpyHostToDevice);
-    cudaMemcpy(params.choosed, g->choosed, sizeof(int)*graphSize, cudaMemcpyHostToDevice);
-    cudaMemcpy(params.choice_inv_map, choice_map, sizeof(int)*graphSize, cudaMemcpyHostToDevice);
+    cudaMemcpy(params.bolt, g->bolt, sizeof(bolt_t)*graphSize, cudaMemcpyHostToDevice);
+    cudaMemcpy(params.choice_inv_map, g->choice_pos, sizeof(int)*graphSize, cudaMemcpyHostToDevice);
     FINISH_ACTIVITY(ACTIVITY_COMM);
 
     while (power > 0) {
         update_charge(g);
-        find_next(g, &power);
+        rng_init(&rng, g->rng_seed, lightning, step++);
+        find_next(g, &power, &rng);
     }
     // one lightning is generated
     update_boundary(g);
@@ -320,14 +319,13 @@ static void simulate_one(graph_t *g) {
 void simulate(graph_t *g, int count, FILE *ofile) {
     int i;
 
-    int graphSize = g->width*g->height;
+    size_t graphSize = graph_cells(g);
 
     double *cuda_charge_buffer;
     double *cuda_charge;
     double *cuda_boundary;
-    int *cuda_bolt;
+    bolt_t *cuda_bolt;
     double* cuda_choice_probs;
-    int* cuda_choosed;
     int* cuda_choice_map;
 
 
@@ -339,15 +337,14 @@ void simulate(graph_t *g, int count, FILE *ofile) {
     params.height = g->height;
     params.eta = g->eta;
     
-    choice_map = (int*)malloc(sizeof(int)*graphSize);
+    sampler = new_sampler();
 
     START_ACTIVITY(ACTIVITY_STARTUP);
     cudaMalloc(&cuda_charge_buffer, sizeof(double)*graphSize);
     cudaMalloc(&cuda_charge, sizeof(double)*graphSize);
     cudaMalloc(&cuda_boundary, sizeof(double)*graphSize);
-    cudaMalloc(&cuda_bolt, sizeof(int)*graphSize);
+    cudaMalloc(&cuda_bolt, sizeof(bolt_t)*graphSize);
     cudaMalloc(&cuda_choice_probs, sizeof(double)*graphSize);
-    cudaMalloc(&cuda_choosed, sizeof(int)*graphSize);
     cudaMalloc(&cuda_choice_map, sizeof(int)*graphSize);
     
     FINISH_ACTIVITY(ACTIVITY_STARTUP);
@@ -356,14 +353,14 @@ void simulate(graph_t *g, int count, FILE *ofile) {
     cudaMemcpy(cuda_charge_buffer, g->charge_buffer, sizeof(double)*graphSize, cudaMemcpyHostToDevice);
     cudaMemcpy(cuda_charge, g->charge, sizeof(double)*graphSize, cudaMemcpyHostToDevice);
     cudaMemcpy(cuda_boundary, g->boundary, sizeof(double)*graphSize, cudaMemcpyHostToDevice);
-    cudaMemcpy(cuda_bolt, g->bolt, sizeof(int)*graphSize, cudaMemcpyHostToDevice);
+    cudaMemcpy(cuda_bolt, g->bolt, sizeof(bolt_t)*graphSize, cudaMemcpyHostToDevice);
+    cudaMemcpy(cuda_choice_map, g->choice_pos, sizeof(int)*graphSize, cudaMemcpyHostToDevice);
 
     params.charge = cuda_charge;
     params.charge_buffer = cuda_charge_buffer;
     params.boundary = cuda_boundary;
     params.bolt = cuda_bolt;
     params.choice_probs = cuda_choice_probs;
-    params.choosed = cuda_choosed;
     params.choice_inv_map = cuda_choice_map;
 
     cudaMemcpyToSymbol(cuConstGraph, &params, sizeof(GlobalConstants));
@@ -374,14 +371,18 @@ void simulate(graph_t *g, int count, FILE *ofile) {
         update_charge(g);
     }
    
-    // generate lightnings
+    // generate lightnings, a frame is printed while the next is simulated
+    writer_t *writer = new_writer(g, ofile);
     for (i = 0; i < count; i++) {
-        simulate_one(g);
+        simulate_one(g, i);
 
         START_ACTIVITY(ACTIVITY_PRINT);
         // print bolt
-        print_graph(g, ofile);
-        fprintf(ofile, "\n");
+        writer_put(writer, g);
         FINISH_ACTIVITY(ACTIVITY_PRINT);
     }
+    START_ACTIVITY(ACTIVITY_PRINT);
+    free_writer(writer);
+    FINISH_ACTIVITY(ACTIVITY_PRINT);
+    free_sampler(sampler);
 }
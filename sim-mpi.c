@@ -5,65 +5,40 @@
 #include "graph.h"
 #include "mpiutil.h"
 #include "sim-mpi.h"
+#include "stencil.h"
+#include "sampler.h"
+#include "prob.h"
+#include "rng.h"
 #include "instrument.h"
+#include "writer.h"
 
-/* What is the crossover between binary and linear search */
-#define BINARY_THRESHOLD 4
-
-/*
-  Linear search
- */
-static inline int locate_value_linear(double target, double *list, int len) {
-    int i;
-    for (i = 0; i < len; i++)
-	    if (target < list[i])
-	        return i;
-    /* Shouldn't get here */
-    return -1;
-}
-
-/*
-  Binary search down to threshold, and then linear
- */
-static inline int locate_value(double target, double *list, int len) {
-    int left = 0;
-    int right = len-1;
-    while (left < right) {
-	    if (right-left+1 < BINARY_THRESHOLD)
-	        return left + locate_value_linear(target, list+left, right-left+1);
-	    int mid = left + (right-left)/2;
-	    if (target < list[mid])
-	        right = mid;
-	    else
-	        left = mid+1;
-    }
-    return right;
-}
+/* charge^eta of the choices, picked for z->eta */
+static prob_kernel_t prob_pow = NULL;
 
 static void reset_charge(zone_t *z) {
-    int i;
-    for (i = 0; i < z->height * z->width; i++) {
+    idx_t i;
+    for (i = 0; i < (idx_t)(z->height + 2) * z->pitch; i++) {
         z->charge[i] = z->charge_buffer[i] = 0;
     }
 }
 
 static void reset_boundary(zone_t *z) {
-    int i;
-    for (i = 0; i < z->height * z->width; i++) {
+    idx_t i;
+    for (i = 0; i < (idx_t)z->height * z->width; i++) {
         z->boundary[i] = 0.0;
     }
 }
 
 static void reset_bolt(graph_t *g) {
-    int i;
-    for (i = 0; i < g->height * g->width; i++) {
+    idx_t i;
+    for (i = 0; i < graph_cells(g); i++) {
         g->bolt[i] = g->reset_bolt[i];
     }
 }
 
 static void update_boundary(zone_t *z) {
-    int idx;
-    for (idx = 0; idx < z->height * z->width; idx++) {
+    idx_t idx;
+    for (idx = 0; idx < (idx_t)z->height * z->width; idx++) {
         if (z->bolt[idx] > 1) {
             z->boundary[idx] = z->bolt[idx] * 0.0001;
         } else {
@@ -72,58 +47,120 @@ static void update_boundary(zone_t *z) {
     }
 }
 
-static void reset_path(graph_t *g) {
+// undo what the last lightning did to bolt and path, only its touched
+// cells differ from the reset state
+static void reset_touched(graph_t *g) {
     int i;
-    for (i = 0; i < g->height * g->width; i++) {
-        g->path[i] = -1;
+    idx_t idx;
+    for (i = 0; i < g->num_touched; i++) {
+        idx = g->touched_idxs[i];
+        g->bolt[idx] = g->reset_bolt[idx];
+        g->state[idx] = CELL_PATH_NONE;
     }
+    g->num_touched = 0;
 }
 
-static void choose_helper(int process_count, graph_t *g, zonedef_t *zlist, int bolt_idx, int i, int j) {
-    int idx = i * g->width + j;
+// zone holding cell (i, j)
+static int find_zone(int process_count, zonedef_t *zlist, int i, int j) {
     int zid;
-    if (i >= 0 && i < g->height && j >= 0 && j < g->width &&
-        g->choosed[idx] == 0 && g->bolt[idx] <= 0) {
-        g->choosed[idx] = 1;
+    for (zid = 0; zid < process_count; zid++) {
+        if (i >= zlist[zid].start_row && i < zlist[zid].start_row + zlist[zid].height &&
+        j >= zlist[zid].start_col && j < zlist[zid].start_col + zlist[zid].width) {
+            return zid;
+        }
+    }
+    return -1;
+}
+
+// index of cell idx in the arrays of zone zid
+static idx_t zone_idx(graph_t *g, zonedef_t *zlist, int zid, idx_t idx) {
+    int i = cell_row(g, idx);
+    int j = cell_col(g, idx);
+    return (idx_t)(i - zlist[zid].start_row) * zlist[zid].width + j - zlist[zid].start_col;
+}
+
+// path is the side of the bolt cell that reached (i, j)
+static void choose_helper(int process_count, graph_t *g, zonedef_t *zlist, int path, int i, int j) {
+    idx_t idx;
+    idx_t z_idx;
+    int zid;
+    // the tile layout has no index for cells off the graph
+    if (i < 0 || i >= g->height || j < 0 || j >= g->width)
+        return;
+    idx = cell_index(g, i, j);
+    if (g->choice_pos[idx] == -1 && g->bolt[idx] <= 0) {
+        if (g->num_choice == g->max_choice)
+            grow_choices(g);
+        g->choice_pos[idx] = g->num_choice;
         g->choice_idxs[g->num_choice] = idx;
-        for (zid = 0; zid < process_count; zid++) {
-            if (i >= zlist[zid].start_row && i < zlist[zid].start_row + zlist[zid].height &&
-            j >= zlist[zid].start_col && j < zlist[zid].start_col + zlist[zid].width) {
-                zlist[zid].choice_idxs[zlist[zid].num_choice] = (i - zlist[zid].start_row) * zlist[zid].width + j - zlist[zid].start_col;
-                zlist[zid].choice_idx_map[zlist[zid].num_choice] = g->num_choice;
-                zlist[zid].num_choice++;
-                break;
-            }
+        zid = find_zone(process_count, zlist, i, j);
+        if (zid != -1) {
+            z_idx = zone_idx(g, zlist, zid, idx);
+            if (zlist[zid].num_choice == zlist[zid].max_choice)
+                grow_zonedef_choices(&zlist[zid]);
+            zlist[zid].choice_pos[z_idx] = zlist[zid].num_choice;
+            zlist[zid].choice_idxs[zlist[zid].num_choice] = z_idx;
+            zlist[zid].choice_idx_map[zlist[zid].num_choice] = g->num_choice;
+            zlist[zid].num_choice++;
         }
         g->num_choice++;
-        g->path[idx] = bolt_idx;
+        touch_cell(g, idx);
+        g->state[idx] = (g->state[idx] & ~CELL_PATH_MASK) | path;
     }
 }
 
-static void find_choice(int process_count, graph_t *g, zonedef_t *zlist, int idx) {
+// drop the cell that became bolt, the last choice takes its slot, in
+// the frontier and in the list of its zone
+static void remove_choice(int process_count, graph_t *g, zonedef_t *zlist, idx_t idx) {
+    int slot = g->choice_pos[idx];
+    idx_t last = g->choice_idxs[--g->num_choice];
+    idx_t z_idx;
+    int zid, z_slot, z_last;
+
+    g->choice_idxs[slot] = last;
+    g->choice_pos[last] = slot;
+    g->choice_pos[idx] = -1;
+    zid = find_zone(process_count, zlist, cell_row(g, last), cell_col(g, last));
+    z_idx = zone_idx(g, zlist, zid, last);
+    zlist[zid].choice_idx_map[zlist[zid].choice_pos[z_idx]] = slot;
+
+    zid = find_zone(process_count, zlist, cell_row(g, idx), cell_col(g, idx));
+    z_idx = zone_idx(g, zlist, zid, idx);
+    z_slot = zlist[zid].choice_pos[z_idx];
+    z_last = --zlist[zid].num_choice;
+    zlist[zid].choice_idxs[z_slot] = zlist[zid].choice_idxs[z_last];
+    zlist[zid].choice_idx_map[z_slot] = zlist[zid].choice_idx_map[z_last];
+    zlist[zid].choice_pos[zlist[zid].choice_idxs[z_slot]] = z_slot;
+    zlist[zid].choice_pos[z_idx] = -1;
+}
+
+static void find_choice(int process_count, graph_t *g, zonedef_t *zlist, idx_t idx) {
     int i, j;
     if (g->bolt[idx] > 0) {
-        i = idx / g->width;
-        j = idx % g->width;
-        choose_helper(process_count, g, zlist, idx, i - 1, j);
-        choose_helper(process_count, g, zlist, idx, i, j - 1);
-        choose_helper(process_count, g, zlist, idx, i, j + 1);
-        choose_helper(process_count, g, zlist, idx, i + 1, j);
+        i = cell_row(g, idx);
+        j = cell_col(g, idx);
+        choose_helper(process_count, g, zlist, CELL_PATH_DOWN, i - 1, j);
+        choose_helper(process_count, g, zlist, CELL_PATH_RIGHT, i, j - 1);
+        choose_helper(process_count, g, zlist, CELL_PATH_LEFT, i, j + 1);
+        choose_helper(process_count, g, zlist, CELL_PATH_UP, i + 1, j);
     }
 }
 
 static void reset_choice(int process_count, graph_t *g, zonedef_t *zlist) {
-    int i;
-    g->num_choice = 0;
-    for (i = 0; i < g->height * g->width; i++) {
-        g->choosed[i] = 0;
+    int i, zid;
+    for (i = 0; i < g->num_choice; i++) {
+        g->choice_pos[g->choice_idxs[i]] = -1;
     }
-    for (i = 0; i < process_count; i++) {
-        zlist[i].num_choice = 0;
+    g->num_choice = 0;
+    for (zid = 0; zid < process_count; zid++) {
+        for (i = 0; i < zlist[zid].num_choice; i++) {
+            zlist[zid].choice_pos[zlist[zid].choice_idxs[i]] = -1;
+        }
+        zlist[zid].num_choice = 0;
     }
-    // get choices idxs
-    for (i = 0; i < g->width * g->height; i++) {
-        find_choice(process_count, g, zlist, i);
+    // get choices idxs around the reset bolts
+    for (i = 0; i < g->num_seed; i++) {
+        find_choice(process_count, g, zlist, g->seed_idxs[i]);
     }
 }
 
@@ -131,88 +168,112 @@ static void reset_choice(int process_count, graph_t *g, zonedef_t *zlist) {
 // if bolt < 0.0, charge = 1.0 // boundary
 // if bolt > 0.0, charge = 0.0 // boundary
 // else charge = (boundary + neighbor's charge) / 4
+// the halos are in the ghost cells, every row is a uniform stencil
 static void update_charge(zone_t *z) {
     int height = z->height;
     int width = z->width;
-    int i, j, idx;
-    double sum;
+    int pitch = z->pitch;
+    int i;
+    real_t *row;
+    real_t *tmp;
 
     exchange_charge(z);
 
     START_ACTIVITY(ACTIVITY_UPDATE);
-    for (idx = 0; idx < height * width; idx++) {
-        i = idx / width;
-        j = idx % width;
-
-        // boundary condition
-        if (z->bolt[idx] < 0) {
-            z->charge_buffer[idx] = 1;
-        } else if (z->bolt[idx] > 0) {
-            z->charge_buffer[idx] = 0;
-        } else {
-            sum = z->boundary[idx]; // poisson equation
-            sum += get_charge(z, i - 1, j);
-            sum += get_charge(z, i, j - 1);
-            sum += get_charge(z, i, j + 1);
-            sum += get_charge(z, i + 1, j);
-            z->charge_buffer[idx] = sum / 4;
-        }
+    for (i = 0; i < height; i++) {
+        row = z->charge + (idx_t)(i + 1) * pitch + 1;
+        stencil_row(row - pitch, row, row + pitch, z->boundary + (idx_t)i * width, z->dirichlet + (idx_t)i * width,
+                    z->charge_buffer + (idx_t)(i + 1) * pitch + 1, width, row[-1], row[width]);
     }
 
     // replace origin
-    for (idx = 0; idx < height * width; idx++) {
-        z->charge[idx] = z->charge_buffer[idx];
-    }
+    tmp = z->charge;
+    z->charge = z->charge_buffer;
+    z->charge_buffer = tmp;
     FINISH_ACTIVITY(ACTIVITY_UPDATE);
 }
 
 // add charge to bolt along the path
-static void discharge(graph_t *g, int index, int charge) {
+static void discharge(graph_t *g, idx_t index, int charge) {
     int count = 500;
     while (index != -1 && count > 0) {
         count -= 1;
+        touch_cell(g, index);
         g->bolt[index] += charge;
-        index = g->path[index];
+        index = path_next(g, index);
     }
 }
 
 static void calc_prob(zone_t *z) {
-    int i, idx;
+    int i;
 
     START_ACTIVITY(ACTIVITY_NEXT);
     // calculate probability based on latest charge
-    for (i = 0; i < z->num_choice; i++) {
-        idx = z->choice_idxs[i];
-        if (z->bolt[idx] > 0) {
-            z->prob_buf[i] = 0;
-        } else {
-            z->prob_buf[i] = pow(z->charge[idx], z->eta);
+    if (prob_needs_charge(z->eta)) {
+        for (i = 0; i < z->num_choice; i++) {
+            z->prob_buf[i] = zone_charge(z, z->choice_idxs[i]);
         }
     }
+    prob_pow(z->prob_buf, z->num_choice, z->eta);
     FINISH_ACTIVITY(ACTIVITY_NEXT);
 }
 
-static int find_next(graph_t *g) {
-    int i, choice;
+// a drawn cell is not drawn again in the same solve and neither are
+// its neighbors, their potential is about to drop
+static void exclude_choice(graph_t *g, sampler_t *sampler, idx_t idx) {
+    static const int di[5] = {0, -1, 0, 0, 1};
+    static const int dj[5] = {0, 0, -1, 1, 0};
+    int i = cell_row(g, idx);
+    int j = cell_col(g, idx);
+    int k;
+    for (k = 0; k < 5; k++) {
+        int ii = i + di[k];
+        int jj = j + dj[k];
+        if (ii >= 0 && ii < g->height && jj >= 0 && jj < g->width &&
+            g->choice_pos[cell_index(g, ii, jj)] != -1)
+            sampler_update(sampler, g->choice_pos[cell_index(g, ii, jj)], 0.0);
+    }
+}
+
+// draw up to g->grow cells into next from the stream rng, returns how many
+static int find_next(graph_t *g, sampler_t *sampler, idx_t *next, rng_t *rng) {
+    int choice, num;
     double breach;
-    for (i = 1; i < g->num_choice; i++) {
-        g->choice_probs[i] += g->choice_probs[i - 1];
+    sampler_build(sampler, g->choice_probs, g->num_choice);
+    for (num = 0; num < g->grow; num++) {
+        breach = rng_next(rng) * sampler_total(sampler);
+        choice = sampler_draw(sampler, breach);
+        // only cells of weight 0 are left to draw
+        if (choice == -1 || (num > 0 && sampler->weight[choice] <= 0.0))
+            break;
+        next[num] = g->choice_idxs[choice];
+        if (g->grow > 1)
+            exclude_choice(g, sampler, next[num]);
+    }
+    return num;
+}
+
+// turn the drawn cell idx into bolt
+static void grow_bolt(int process_count, graph_t *g, zonedef_t *zlist, idx_t idx, int *power) {
+    if (g->bolt[idx] < 0) {
+        *power += g->bolt[idx];
+        discharge(g, idx, -g->bolt[idx]);
     }
-    breach = (double)rand()/RAND_MAX * g->choice_probs[g->num_choice - 1];
-    choice = locate_value(breach, g->choice_probs, g->num_choice);
-    if (choice == -1)
-        return -1;
-    return g->choice_idxs[choice];
+    g->bolt[idx] = 1;
+    remove_choice(process_count, g, zlist, idx);
+    find_choice(process_count, g, zlist, idx);
 }
 
-static void simulate_one(int process_count, bool mpi_master, graph_t *g, zonedef_t *zlist, zone_t *z) {
+static void simulate_one(int process_count, bool mpi_master, graph_t *g, zonedef_t *zlist, zone_t *z,
+                         sampler_t *sampler, idx_t *next_bolts, long lightning) {
     int power;
+    long step = 0;
+    rng_t rng;
 
     START_ACTIVITY(ACTIVITY_RECOVER);
     if (mpi_master) {
         power = g->power;
-        reset_bolt(g);
-        reset_path(g);
+        reset_touched(g);
         reset_choice(process_count, g, zlist);
     }
     FINISH_ACTIVITY(ACTIVITY_RECOVER);
@@ -229,15 +290,13 @@ static void simulate_one(int process_count, bool mpi_master, graph_t *g, zonedef
 
         if (mpi_master) {
             START_ACTIVITY(ACTIVITY_NEXT);
-            int next_bolt = -1;
-            next_bolt = find_next(g);
-            if (next_bolt != -1) {
-                if (g->bolt[next_bolt] < 0) {
-                    power += g->bolt[next_bolt];
-                    discharge(g, next_bolt, -g->bolt[next_bolt]);
-                }
-                g->bolt[next_bolt] = 1;
-                find_choice(process_count, g, zlist, next_bolt);
+            int num;
+            rng_init(&rng, g->rng_seed, lightning, step++);
+            num = find_next(g, sampler, next_bolts, &rng);
+            int k;
+            // the cells stop growing once a ground took the last power
+            for (k = 0; k < num && power > 0; k++) {
+                grow_bolt(process_count, g, zlist, next_bolts[k], &power);
             }
             FINISH_ACTIVITY(ACTIVITY_NEXT);
         }
@@ -253,9 +312,16 @@ static void simulate_one(int process_count, bool mpi_master, graph_t *g, zonedef
 }
 
 void simulate(int process_count, bool mpi_master, graph_t *g, zonedef_t *zlist, zone_t *z, int count, FILE *ofile) {
+    // draws the next bolt on the master
+    sampler_t *sampler = mpi_master ? new_sampler() : NULL;
+    idx_t *next_bolts = mpi_master ? (idx_t*)malloc(g->grow * sizeof(idx_t)) : NULL;
+    // prints a frame while the next is simulated
+    writer_t *writer = mpi_master ? new_writer(g, ofile) : NULL;
     int i;
 
     // init graph
+    stencil_init();
+    prob_pow = prob_kernel(z->eta);
     if (mpi_master) {
         reset_bolt(g);
     }
@@ -269,14 +335,20 @@ void simulate(int process_count, bool mpi_master, graph_t *g, zonedef_t *zlist,
 
     // generate lightnings
     for (i = 0; i < count; i++) {
-        simulate_one(process_count, mpi_master, g, zlist, z);
+        simulate_one(process_count, mpi_master, g, zlist, z, sampler, next_bolts, i);
 
         START_ACTIVITY(ACTIVITY_PRINT);
         // print bolt
         if (mpi_master) {
-            print_graph(g, ofile);
-            fprintf(ofile, "\n");
+            writer_put(writer, g);
         }
         FINISH_ACTIVITY(ACTIVITY_PRINT);
     }
+    START_ACTIVITY(ACTIVITY_PRINT);
+    if (mpi_master) {
+        free_writer(writer);
+    }
+    FINISH_ACTIVITY(ACTIVITY_PRINT);
+    free_sampler(sampler);
+    free(next_bolts);
 }
@@ -1,226 +1,794 @@
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <omp.h>
 #include "graph.h"
 #include "sim.h"
+#include "multigrid.h"
+#include "stencil.h"
+#include "sampler.h"
+#include "prob.h"
+#include "rng.h"
 #include "instrument.h"
+#include "writer.h"
 
-/* What is the crossover between binary and linear search */
-#define BINARY_THRESHOLD 4
+/* Upper bound of sweeps of one solve with -T */
+#define MAX_SWEEPS 100000
 
-/*
-  Linear search
- */
-static inline int locate_value_linear(double target, double *list, int len) {
-    int i;
-    for (i = 0; i < len; i++)
-	    if (target < list[i])
-	        return i;
-    /* Shouldn't get here */
-    return -1;
-}
-
-/*
-  Binary search down to threshold, and then linear
- */
-static inline int locate_value(double target, double *list, int len) {
-    int left = 0;
-    int right = len-1;
-    while (left < right) {
-	    if (right-left+1 < BINARY_THRESHOLD)
-	        return left + locate_value_linear(target, list+left, right-left+1);
-	    int mid = left + (right-left)/2;
-	    if (target < list[mid])
-	        right = mid;
-	    else
-	        left = mid+1;
-    }
-    return right;
+/* Max residual of the current sweep, reduced over the team */
+static double sweep_residual;
+
+/* Temporal blocking of jacobi: tiles are advanced up to TIME_STEPS
+   sweeps at once while they stay in cache */
+#define TILE_HEIGHT 64
+#define TILE_WIDTH 256
+#define TIME_STEPS 8
+
+/* Active tiles of the jacobi sweeps, the tiles of the temporal blocking.
+   A tile is swept while active > 0. A tile whose cells moved by more
+   than the threshold keeps itself and its 8 neighbors active for the
+   next sweep, a bolt change keeps the tiles around it active for 2
+   sweeps. Resting tiles hold the same values in charge and
+   charge_buffer. Without -T only tiles that did not move at all rest,
+   with -T tiles rest below ACTIVE_TOL_FRACTION of the target residual */
+#define ACTIVE_TOL_FRACTION 0.1
+static struct {
+    int rows, cols;
+    unsigned char *active; // sweeps left
+    unsigned char *next; // active of the next sweep
+    double *delta; // max change of the free cells in the last sweep
+} tiles = {0, 0, NULL, NULL, NULL};
+
+/* Multigrid hierarchy, only allocated by the mg solver */
+static multigrid_t *mg = NULL;
+/* Draws the next bolt among the choices */
+static sampler_t *sampler = NULL;
+/* Cells drawn by the last find_next */
+static idx_t *next_bolts = NULL;
+/* charge^eta of the choices, picked for g->eta */
+static prob_kernel_t prob_pow = NULL;
+/* Choices a thread weighs in one go */
+#define PROB_BLOCK 256
+
+/* Local solver: half width of the first window around changed cells,
+   residual target when -T is not given, and how many solves may pass
+   before the whole graph is swept again */
+#define LOCAL_RADIUS 8
+#define LOCAL_TOL 1e-4
+#define LOCAL_FULL_PERIOD 64
+
+/* Bounding box of the dirichlet cells changed since the last local solve,
+   only written by the master */
+static struct {
+    int top, left, bottom, right; // inclusive, empty when top > bottom
+    int steps; // local solves since the last full sweep
+} dirty = {0, 0, -1, -1, 0};
+
+static void mark_changed(graph_t *g, idx_t idx) {
+    int i = (int)(idx / g->width);
+    int j = (int)(idx % g->width);
+    if (dirty.top > dirty.bottom) {
+        dirty.top = dirty.bottom = i;
+        dirty.left = dirty.right = j;
+        return;
+    }
+    if (i < dirty.top) dirty.top = i;
+    if (i > dirty.bottom) dirty.bottom = i;
+    if (j < dirty.left) dirty.left = j;
+    if (j > dirty.right) dirty.right = j;
+}
+
+static void new_tiles(graph_t *g) {
+    int n;
+    tiles.rows = (g->height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+    tiles.cols = (g->width + TILE_WIDTH - 1) / TILE_WIDTH;
+    n = tiles.rows * tiles.cols;
+    tiles.active = (unsigned char*)calloc(n, sizeof(unsigned char));
+    tiles.next = (unsigned char*)calloc(n, sizeof(unsigned char));
+    tiles.delta = (double*)calloc(n, sizeof(double));
+}
+
+static void free_tiles(void) {
+    free(tiles.active);
+    free(tiles.next);
+    free(tiles.delta);
+    tiles.active = tiles.next = NULL;
+    tiles.delta = NULL;
+}
+
+// every tile sweeps again
+static void wake_all(void) {
+    if (tiles.active != NULL)
+        memset(tiles.active, 2, tiles.rows * tiles.cols);
+}
+
+// the bolt at idx changed, the tiles of the cell and of its neighbors sweep again
+static void wake_cell(graph_t *g, idx_t idx) {
+    static const int di[5] = {0, -1, 0, 0, 1};
+    static const int dj[5] = {0, 0, -1, 1, 0};
+    int i = cell_row(g, idx);
+    int j = cell_col(g, idx);
+    int k;
+    if (tiles.active == NULL)
+        return;
+    for (k = 0; k < 5; k++) {
+        int ii = i + di[k];
+        int jj = j + dj[k];
+        if (ii >= 0 && ii < g->height && jj >= 0 && jj < g->width)
+            tiles.active[ii / TILE_HEIGHT * tiles.cols + jj / TILE_WIDTH] = 2;
+    }
+}
+
+static void tile_bounds(graph_t *g, int t, int *top, int *left, int *bottom, int *right) {
+    *top = t / tiles.cols * TILE_HEIGHT;
+    *left = t % tiles.cols * TILE_WIDTH;
+    *bottom = *top + TILE_HEIGHT < g->height ? *top + TILE_HEIGHT : g->height;
+    *right = *left + TILE_WIDTH < g->width ? *left + TILE_WIDTH : g->width;
+}
+
+// sweeps of a file backed graph (-D) go band by band of tile rows, the
+// band below band r is read ahead and the band two above it, which no
+// tile reads any more, is dropped, so the sweep holds three bands
+static void stream_band(graph_t *g, int r) {
+    if (!g->arena->file)
+        return;
+    advise_rows(g, (r + 1) * TILE_HEIGHT, (r + 2) * TILE_HEIGHT, ARENA_WILLNEED);
+    advise_rows(g, (r - 2) * TILE_HEIGHT, (r - 1) * TILE_HEIGHT, ARENA_DONTNEED);
+}
+
+// after a sweep into charge_buffer pick the tiles of the next sweep,
+// tiles going to rest copy their new values into charge as well
+static void retire_tiles(graph_t *g) {
+    int n = tiles.rows * tiles.cols;
+    int t, ti, tj, i, j, run;
+    idx_t idx;
+    int top, left, bottom, right;
+    double eps = g->tol > 0.0 ? g->tol * ACTIVE_TOL_FRACTION / 4 : 0.0;
+    unsigned char *tmp;
+
+    memset(tiles.next, 0, n);
+    for (t = 0; t < n; t++) {
+        if (tiles.active[t] == 0)
+            continue;
+        if (tiles.next[t] < tiles.active[t] - 1)
+            tiles.next[t] = tiles.active[t] - 1;
+        if (tiles.delta[t] <= eps)
+            continue;
+        for (ti = t / tiles.cols - 1; ti <= t / tiles.cols + 1; ti++) {
+            for (tj = t % tiles.cols - 1; tj <= t % tiles.cols + 1; tj++) {
+                if (ti >= 0 && ti < tiles.rows && tj >= 0 && tj < tiles.cols &&
+                    tiles.next[ti * tiles.cols + tj] == 0)
+                    tiles.next[ti * tiles.cols + tj] = 1;
+            }
+        }
+    }
+    for (t = 0; t < n; t++) {
+        if (tiles.active[t] == 0 || tiles.next[t] != 0)
+            continue;
+        tile_bounds(g, t, &top, &left, &bottom, &right);
+        run = cell_run(g) < right - left ? cell_run(g) : right - left;
+        for (i = top; i < bottom; i++) {
+            for (j = left; j < right; j += run) {
+                idx = cell_index(g, i, j);
+                memcpy(g->charge + idx, g->charge_buffer + idx, run * sizeof(real_t));
+            }
+        }
+    }
+    tmp = tiles.active;
+    tiles.active = tiles.next;
+    tiles.next = tmp;
 }
 
 static void reset_charge(graph_t *g) {
-    int i;
-    for (i = 0; i < g->height * g->width; i++) {
-        g->charge[i] = g->charge_buffer[i] = 0;
+    idx_t i;
+    // jacobi is the only solver that needs a second copy of the field
+    if (g->solver == SOLVER_JACOBI && g->charge_buffer == NULL) {
+        g->charge_buffer = new_field(g->arena, g->height, g->width);
+        g->dirichlet = (real_t*)arena_alloc(g->arena, (size_t)g->height * g->width * sizeof(real_t));
+    }
+    if (g->solver == SOLVER_JACOBI && tiles.active == NULL) {
+        new_tiles(g);
+    }
+    wake_all();
+    for (i = 0; i < graph_cells(g); i++) {
+        g->charge[i] = 0;
+        if (g->charge_buffer != NULL)
+            g->charge_buffer[i] = 0;
+        if (g->dirichlet != NULL)
+            g->dirichlet[i] = dirichlet_value(g->bolt[i]);
     }
 }
 
 static void reset_boundary(graph_t *g) {
-    int i;
-    for (i = 0; i < g->height * g->width; i++) {
+    idx_t i;
+    for (i = 0; i < graph_cells(g); i++) {
         g->boundary[i] = 0.0;
     }
 }
 
 static void reset_bolt(graph_t *g) {
-    int i;
-    for (i = 0; i < g->height * g->width; i++) {
+    idx_t i;
+    for (i = 0; i < graph_cells(g); i++) {
+        if (g->solver == SOLVER_LOCAL && g->bolt[i] != g->reset_bolt[i])
+            mark_changed(g, i);
         g->bolt[i] = g->reset_bolt[i];
+        if (g->dirichlet != NULL)
+            g->dirichlet[i] = dirichlet_value(g->bolt[i]);
+    }
+    wake_all();
+}
+
+// undo what the last lightning did to bolt and path, only its touched
+// cells differ from the reset state
+static void reset_touched(graph_t *g) {
+    int i;
+    idx_t idx;
+    for (i = 0; i < g->num_touched; i++) {
+        idx = g->touched_idxs[i];
+        if (g->solver == SOLVER_LOCAL && g->bolt[idx] != g->reset_bolt[idx])
+            mark_changed(g, idx);
+        g->bolt[idx] = g->reset_bolt[idx];
+        g->state[idx] = CELL_PATH_NONE;
+        if (g->dirichlet != NULL)
+            g->dirichlet[idx] = dirichlet_value(g->bolt[idx]);
+    }
+    g->num_touched = 0;
+    wake_all();
+}
+
+// charge density of the cells of idxs with more than 1 charge
+static void charge_cells(graph_t *g, const idx_t *idxs, int num) {
+    int i;
+    idx_t idx;
+    for (i = 0; i < num; i++) {
+        idx = idxs[i];
+        if (g->bolt[idx] > 1 && g->boundary[idx] == 0) {
+            g->boundary[idx] = g->bolt[idx] * 0.0001;
+            if (g->num_charged == g->max_charged)
+                grow_charged(g);
+            g->charged_idxs[g->num_charged++] = idx;
+        }
     }
 }
 
-static void reset_path(graph_t *g) {
+// one lightning is generated, a bolt cell with more than 1 charge is
+// either a reset bolt or touched by it
+static void update_boundary(graph_t *g) {
     int i;
-    for (i = 0; i < g->height * g->width; i++) {
-        g->path[i] = -1;
+    for (i = 0; i < g->num_charged; i++) {
+        g->boundary[g->charged_idxs[i]] = 0;
     }
+    g->num_charged = 0;
+    charge_cells(g, g->touched_idxs, g->num_touched);
+    charge_cells(g, g->seed_idxs, g->num_seed);
 }
 
-static void choose_helper(graph_t *g, int bolt_idx, int i, int j) {
-    int idx = i * g->width + j;
-    if (i >= 0 && i < g->height && j >= 0 && j < g->width &&
-        g->choosed[idx] == 0 && g->bolt[idx] <= 0) {
-        g->choosed[idx] = 1;
+// path is the side of the bolt cell that reached (i, j)
+static void choose_helper(graph_t *g, int path, int i, int j) {
+    idx_t idx;
+    // the tile layout has no index for cells off the graph
+    if (i < 0 || i >= g->height || j < 0 || j >= g->width)
+        return;
+    idx = cell_index(g, i, j);
+    if (g->choice_pos[idx] == -1 && g->bolt[idx] <= 0) {
+        if (g->num_choice == g->max_choice)
+            grow_choices(g);
+        g->choice_pos[idx] = g->num_choice;
         g->choice_idxs[g->num_choice] = idx;
         g->num_choice++;
-        g->path[idx] = bolt_idx;
+        touch_cell(g, idx);
+        g->state[idx] = (g->state[idx] & ~CELL_PATH_MASK) | path;
     }
 }
 
-static void find_choice(graph_t *g, int idx) {
+static void find_choice(graph_t *g, idx_t idx) {
     int i, j;
     if (g->bolt[idx] > 0) {
-        i = idx / g->width;
-        j = idx % g->width;
-        choose_helper(g, idx, i - 1, j);
-        choose_helper(g, idx, i, j - 1);
-        choose_helper(g, idx, i, j + 1);
-        choose_helper(g, idx, i + 1, j);
+        i = cell_row(g, idx);
+        j = cell_col(g, idx);
+        choose_helper(g, CELL_PATH_DOWN, i - 1, j);
+        choose_helper(g, CELL_PATH_RIGHT, i, j - 1);
+        choose_helper(g, CELL_PATH_LEFT, i, j + 1);
+        choose_helper(g, CELL_PATH_UP, i + 1, j);
     }
 }
 
 
+// drop the cell that became bolt, the last choice takes its slot
+static void remove_choice(graph_t *g, idx_t idx) {
+    int slot = g->choice_pos[idx];
+    idx_t last = g->choice_idxs[--g->num_choice];
+    g->choice_idxs[slot] = last;
+    g->choice_pos[last] = slot;
+    g->choice_pos[idx] = -1;
+}
+
 static void reset_choice(graph_t *g) {
     int i;
+    for (i = 0; i < g->num_choice; i++) {
+        g->choice_pos[g->choice_idxs[i]] = -1;
+    }
     g->num_choice = 0;
-    for (i = 0; i < g->height * g->width; i++) {
-        g->choosed[i] = 0;
+    // get choices idxs around the reset bolts
+    for (i = 0; i < g->num_seed; i++) {
+        find_choice(g, g->seed_idxs[i]);
+    }
+}
+
+// one sweep of the cells of tile t into charge_buffer
+// cells are swept in runs contiguous in memory, tile rows in the row
+// layout and rows of a storage tile in the tile layout
+// returns the max charge change of the free cells
+static double jacobi_tile(graph_t *g, int t) {
+    int i, j, n;
+    idx_t idx;
+    int top, left, bottom, right;
+    idx_t size = graph_cells(g);
+    real_t *up, *down;
+    real_t lval, rval;
+    double delta = 0.0;
+
+    tile_bounds(g, t, &top, &left, &bottom, &right);
+    n = cell_run(g) < right - left ? cell_run(g) : right - left;
+    for (i = top; i < bottom; i++) {
+        for (j = left; j < right; j += n) {
+            idx = cell_index(g, i, j);
+            up = i > 0 ? g->charge + cell_index(g, i - 1, j) : g->charge - n;
+            down = i < g->height - 1 ? g->charge + cell_index(g, i + 1, j) : g->charge + size;
+            lval = j > 0 ? g->charge[cell_index(g, i, j - 1)] : 0.0;
+            rval = j + n < g->width ? g->charge[cell_index(g, i, j + n)] : 0.0;
+            delta = fmax(delta, stencil_row(up, g->charge + idx, down, g->boundary + idx, g->dirichlet + idx,
+                                            g->charge_buffer + idx, n, lval, rval));
+        }
+    }
+    tiles.delta[t] = delta;
+    return delta;
+}
+
+// returns the max residual of the free cells before the sweep
+static double update_charge_jacobi(graph_t *g) {
+    int n = tiles.rows * tiles.cols;
+    int band = g->arena->file ? tiles.cols : n;
+    int b, t;
+    double residual;
+    #pragma omp single
+    sweep_residual = 0.0;
+    // a file backed graph is swept one band of tile rows after the other
+    for (b = 0; b < n; b += band) {
+        if (band < n) {
+            #pragma omp single
+            stream_band(g, b / band);
+        }
+        #pragma omp for schedule(dynamic) reduction(max:sweep_residual)
+        for (t = b; t < b + band; t++) {
+            if (tiles.active[t] > 0) {
+                // residual = 4 * (new - old)
+                sweep_residual = fmax(sweep_residual, 4 * jacobi_tile(g, t));
+            }
+        }
+    }
+
+    // the new field is complete in charge_buffer
+    #pragma omp single
+    {
+        real_t *tmp = g->charge;
+        retire_tiles(g);
+        g->charge = g->charge_buffer;
+        g->charge_buffer = tmp;
+    }
+    residual = sweep_residual;
+    // nobody may reset sweep_residual before every thread has read it
+    #pragma omp barrier
+    return residual;
+}
+
+// update the cells of one tile `steps` jacobi sweeps ahead, row layout only.
+// the tile is copied into cur together with a halo of `steps` cells
+// and one more row above and below, every sweep the computed area
+// shrinks by one cell per side, so the tile ends with the values
+// `steps` full sweeps would give it.
+// returns the max charge change of the free cells in the last sweep
+static double sweep_tile(graph_t *g, int top, int left, int steps, real_t *cur, real_t *next) {
+    int width = g->width;
+    int height = g->height;
+    int bottom = top + TILE_HEIGHT < height ? top + TILE_HEIGHT : height;
+    int right = left + TILE_WIDTH < width ? left + TILE_WIDTH : width;
+    int etop = top - steps > 0 ? top - steps : 0;
+    int eleft = left - steps > 0 ? left - steps : 0;
+    int ebottom = bottom + steps < height ? bottom + steps : height;
+    int eright = right + steps < width ? right + steps : width;
+    int pitch = eright - eleft;
+    int i, s, t;
+    idx_t idx;
+    double d, delta = 0.0;
+    real_t *tmp;
+
+    // at the graph edge the extra rows are the ghost rows of the field
+    for (i = etop - 1; i <= ebottom; i++) {
+        memcpy(cur + (i - etop + 1) * pitch, g->charge + (idx_t)i * width + eleft, pitch * sizeof(real_t));
+    }
+    memcpy(next, cur, pitch * sizeof(real_t));
+    memcpy(next + (ebottom - etop + 1) * pitch, cur + (ebottom - etop + 1) * pitch, pitch * sizeof(real_t));
+
+    for (s = 1; s <= steps; s++) {
+        int halo = steps - s;
+        int rtop = top - halo > 0 ? top - halo : 0;
+        int rleft = left - halo > 0 ? left - halo : 0;
+        int rbottom = bottom + halo < height ? bottom + halo : height;
+        int rright = right + halo < width ? right + halo : width;
+        for (i = rtop; i < rbottom; i++) {
+            idx = (idx_t)i * width + rleft;
+            t = (i - etop + 1) * pitch + rleft - eleft;
+            d = stencil_row(cur + t - pitch, cur + t, cur + t + pitch,
+                            g->boundary + idx, g->dirichlet + idx, next + t, rright - rleft,
+                            rleft > 0 ? cur[t - 1] : 0.0, rright < width ? cur[t + rright - rleft] : 0.0);
+            if (s == steps)
+                delta = fmax(delta, d);
+        }
+        tmp = cur;
+        cur = next;
+        next = tmp;
+    }
+
+    for (i = top; i < bottom; i++) {
+        memcpy(g->charge_buffer + (idx_t)i * width + left, cur + (i - etop + 1) * pitch + left - eleft,
+               (right - left) * sizeof(real_t));
+    }
+    return delta;
+}
+
+// `steps` jacobi sweeps, tile by tile, every thread sweeps its
+// tiles in its own scratch buffers
+// returns the max residual of the free cells before the last sweep
+static double update_charge_blocked(graph_t *g, int steps) {
+    int size = (TILE_HEIGHT + 2 * steps + 2) * (TILE_WIDTH + 2 * steps);
+    real_t *cur = (real_t*)malloc(size * sizeof(real_t));
+    real_t *next = (real_t*)malloc(size * sizeof(real_t));
+    int n = tiles.rows * tiles.cols;
+    int band = g->arena->file ? tiles.cols : n;
+    double residual;
+    int b, t;
+
+    #pragma omp single
+    sweep_residual = 0.0;
+    for (b = 0; b < n; b += band) {
+        if (band < n) {
+            #pragma omp single
+            stream_band(g, b / band);
+        }
+        #pragma omp for schedule(dynamic) reduction(max:sweep_residual)
+        for (t = b; t < b + band; t++) {
+            if (tiles.active[t] > 0) {
+                tiles.delta[t] = sweep_tile(g, t / tiles.cols * TILE_HEIGHT, t % tiles.cols * TILE_WIDTH, steps, cur, next);
+                sweep_residual = fmax(sweep_residual, 4 * tiles.delta[t]);
+            }
+        }
     }
-    // get choices idxs
-    for (i = 0; i < g->width * g->height; i++) {
-        find_choice(g, i);
+    free(cur);
+    free(next);
+
+    // the new field is complete in charge_buffer
+    #pragma omp single
+    {
+        real_t *tmp = g->charge;
+        retire_tiles(g);
+        g->charge = g->charge_buffer;
+        g->charge_buffer = tmp;
     }
+    residual = sweep_residual;
+    #pragma omp barrier
+    return residual;
 }
 
-// get bolt at x, y
-// if bolt < 0.0, charge = 1.0 // boundary
-// if bolt > 0.0, charge = 0.0 // boundary
-// else charge = (boundary + neighbor's charge) / 4
-static void update_charge(graph_t *g) {
-    int idx;
+// red-black successive over-relaxation of rows [top, bottom) and
+// columns [left, right), charge is updated in place
+// cells of one color only read cells of the other color, so the rows
+// of a color can be split among threads, the barrier of omp for
+// separates the two colors
+// returns the max residual of the free cells when they were visited
+static double relax_sor(graph_t *g, int top, int left, int bottom, int right) {
+    int color;
     int g_width = g->width;
     int g_height = g->height;
+    double omega = g->omega;
+    double residual;
+    #pragma omp single
+    sweep_residual = 0.0;
+    for (color = 0; color < 2; color++) {
+        int i;
+        #pragma omp for schedule(static) reduction(max:sweep_residual)
+        for (i = top; i < bottom; i++) {
+            int j;
+            for (j = left + ((i + left + color) & 1); j < right; j += 2) {
+                idx_t idx = (idx_t)i * g_width + j;
+                if (g->bolt[idx] < 0) {
+                    g->charge[idx] = 1.0;
+                } else if (g->bolt[idx] > 0) {
+                    g->charge[idx] = 0.0;
+                } else {
+                    double sum = g->boundary[idx]; // poisson equation
+                    if (i > 0)
+                        sum += g->charge[idx - g_width];
+                    if (i < g_height - 1)
+                        sum += g->charge[idx + g_width];
+                    if (j > 0)
+                        sum += g->charge[idx - 1];
+                    if (j < g_width - 1)
+                        sum += g->charge[idx + 1];
+                    sum = sum / 4 - g->charge[idx];
+                    g->charge[idx] += omega * sum;
+                    sweep_residual = fmax(sweep_residual, 4 * fabs(sum));
+                }
+            }
+        }
+    }
+    residual = sweep_residual;
+    #pragma omp barrier
+    return residual;
+}
+
+static double update_charge_sor(graph_t *g) {
+    return relax_sor(g, 0, 0, g->height, g->width);
+}
+
+// residual of a single cell, 0 for dirichlet cells
+static double cell_residual(graph_t *g, int i, int j) {
+    int width = g->width;
+    idx_t idx = (idx_t)i * width + j;
+    double sum;
+    if (g->bolt[idx] != 0)
+        return 0.0;
+    sum = g->boundary[idx] - 4 * g->charge[idx];
+    if (i > 0)
+        sum += g->charge[idx - width];
+    if (i < g->height - 1)
+        sum += g->charge[idx + width];
+    if (j > 0)
+        sum += g->charge[idx - 1];
+    if (j < width - 1)
+        sum += g->charge[idx + 1];
+    return fabs(sum);
+}
+
+// max residual of the ring of cells just outside of a window,
+// they were not relaxed but their inner neighbors were.
+// the ring is short, every thread computes it on its own
+static double ring_residual(graph_t *g, int top, int left, int bottom, int right) {
+    int i, j;
+    double residual = 0.0;
+    for (j = left; j < right; j++) {
+        if (top > 0)
+            residual = fmax(residual, cell_residual(g, top - 1, j));
+        if (bottom < g->height)
+            residual = fmax(residual, cell_residual(g, bottom, j));
+    }
+    for (i = top; i < bottom; i++) {
+        if (left > 0)
+            residual = fmax(residual, cell_residual(g, i, left - 1));
+        if (right < g->width)
+            residual = fmax(residual, cell_residual(g, i, right));
+    }
+    return residual;
+}
+
+// relax only a window around the cells changed since the last solve,
+// the window doubles until the cells around it are converged too
+static double update_charge_local(graph_t *g) {
+    double tol = g->tol > 0.0 ? g->tol : LOCAL_TOL;
+    double residual = 0.0;
+    int radius = LOCAL_RADIUS;
+    int top, left, bottom, right;
+    int full, sweep, periodic;
+
+    #pragma omp single
+    dirty.steps++;
+    // bound the drift of the cells outside of every window
+    periodic = dirty.steps >= LOCAL_FULL_PERIOD;
+    // the next call may count up before a slow thread has looked
+    #pragma omp barrier
+    if (periodic) {
+        residual = update_charge_sor(g);
+        #pragma omp single
+        dirty.steps = 0;
+    }
+    if (dirty.top > dirty.bottom) {
+        return residual;
+    }
+
+    do {
+        top = dirty.top - radius > 0 ? dirty.top - radius : 0;
+        left = dirty.left - radius > 0 ? dirty.left - radius : 0;
+        bottom = dirty.bottom + radius + 1 < g->height ? dirty.bottom + radius + 1 : g->height;
+        right = dirty.right + radius + 1 < g->width ? dirty.right + radius + 1 : g->width;
+        full = top == 0 && left == 0 && bottom == g->height && right == g->width;
+        for (sweep = 0; sweep < (bottom - top) + (right - left); sweep++) {
+            residual = relax_sor(g, top, left, bottom, right);
+            if (residual <= tol)
+                break;
+        }
+        radius *= 2;
+    } while (!full && ring_residual(g, top, left, bottom, right) > tol);
+
+    #pragma omp single
+    {
+        dirty.top = 0;
+        dirty.bottom = -1;
+    }
+    return residual;
+}
+
+static double update_charge(graph_t *g) {
+    double residual;
     #pragma omp master
     {
         START_ACTIVITY(ACTIVITY_UPDATE);
     }
-    #pragma omp for schedule(dynamic,32)
-    for(idx = 0; idx < g_width*g_height; idx++){
-        int i = idx / g_width;
-        int j = idx % g_width;
-        if (g->bolt[idx] < 0) {
-            g->charge_buffer[idx] = 1.0;
-        } else if (g->bolt[idx] > 0) {
-            g->charge_buffer[idx] = 0.0;
-        } else {
-            double sum = g->boundary[idx]; // poisson equation
-            if (i > 0)
-                sum += g->charge[(i - 1) * g_width + j];
-            if (i < g_height - 1)
-                sum += g->charge[(i + 1) * g_width+ j];
-            if (j > 0)
-                sum += g->charge[i * g_width + j - 1];
-            if (j < g_width - 1)
-                sum += g->charge[i * g_width + j + 1];
-            g->charge_buffer[idx] = sum / 4;
-        }
+    switch (g->solver) {
+    case SOLVER_SOR:
+        residual = update_charge_sor(g);
+        break;
+    case SOLVER_MG:
+        residual = mg_cycle(mg, g);
+        break;
+    case SOLVER_LOCAL:
+        residual = update_charge_local(g);
+        break;
+    default:
+        residual = update_charge_jacobi(g);
+        break;
+    }
+    #pragma omp master
+    {
+        FINISH_ACTIVITY(ACTIVITY_UPDATE);
     }
+    return residual;
+}
 
-    // replace origin
-    #pragma omp for
-    for (idx = 0; idx < g->height * g->width; idx++) {
-        g->charge[idx] = g->charge_buffer[idx];
+// several sweeps back to back, jacobi sweeps are temporally blocked
+// returns the residual of the last sweep
+static double update_charge_steps(graph_t *g, int steps) {
+    double residual;
+    if (steps == 1)
+        return update_charge(g);
+    #pragma omp master
+    {
+        START_ACTIVITY(ACTIVITY_UPDATE);
     }
+    residual = update_charge_blocked(g, steps);
     #pragma omp master
     {
         FINISH_ACTIVITY(ACTIVITY_UPDATE);
     }
+    return residual;
+}
+
+// relax the field, a fixed number of sweeps without -T,
+// otherwise until the residual drops below tol.
+// every thread sees the same residual, so they all leave together
+static void solve_charge(graph_t *g, int sweeps) {
+    int i;
+    int steps = g->solver == SOLVER_JACOBI && g->layout == LAYOUT_ROW ? TIME_STEPS : 1;
+    if (g->tol <= 0.0) {
+        for (i = 0; i < sweeps; i += steps) {
+            update_charge_steps(g, sweeps - i < steps ? sweeps - i : steps);
+        }
+        return;
+    }
+    for (i = 0; i < MAX_SWEEPS; i += steps) {
+        if (update_charge_steps(g, steps) <= g->tol)
+            break;
+    }
 }
 
 // add charge to bolt along the path
-static void discharge(graph_t *g, int index, int charge) {
+static void discharge(graph_t *g, idx_t index, int charge) {
     int count = 500;
     while (index != -1 && count > 0) {
         count -= 1;
+        touch_cell(g, index);
         g->bolt[index] += charge;
-        index = g->path[index];
+        index = path_next(g, index);
     }
 }
 
-static void find_next(graph_t *g, int* choice_point) {
-    double breach, prob;
-    int i, idx, choice;
-    int g_eta = g->eta;
+// a drawn cell is not drawn again in the same solve and neither are
+// its neighbors, their potential is about to drop
+static void exclude_choice(graph_t *g, idx_t idx) {
+    static const int di[5] = {0, -1, 0, 0, 1};
+    static const int dj[5] = {0, 0, -1, 1, 0};
+    int i = cell_row(g, idx);
+    int j = cell_col(g, idx);
+    int k;
+    for (k = 0; k < 5; k++) {
+        int ii = i + di[k];
+        int jj = j + dj[k];
+        if (ii >= 0 && ii < g->height && jj >= 0 && jj < g->width &&
+            g->choice_pos[cell_index(g, ii, jj)] != -1)
+            sampler_update(sampler, g->choice_pos[cell_index(g, ii, jj)], 0.0);
+    }
+}
 
-    #pragma omp for 
-    for (i = 0; i < g->num_choice; i++) {
-        idx = g->choice_idxs[i];
+// draw up to g->grow cells into next_bolts from the stream rng of the
+// master, *num_point is how many
+static void find_next(graph_t *g, int *num_point, rng_t *rng) {
+    double breach;
+    int b, i, choice, num;
 
-        if (g->bolt[idx] > 0) {
-            prob = 0;
-        } else {
-            prob = pow(g->charge[idx], g_eta);
+    // calculate probability based on latest charge, a block at a time
+    #pragma omp for schedule(static)
+    for (b = 0; b < g->num_choice; b += PROB_BLOCK) {
+        int n = g->num_choice - b < PROB_BLOCK ? g->num_choice - b : PROB_BLOCK;
+        if (prob_needs_charge(g->eta)) {
+            for (i = b; i < b + n; i++) {
+                g->choice_probs[i] = g->charge[g->choice_idxs[i]];
+            }
         }
-        g->choice_probs[i] = prob;
+        prob_pow(g->choice_probs + b, n, g->eta);
     }
-    
+    sampler_build(sampler, g->choice_probs, g->num_choice);
+
+    // choose as bolt, without replacement
     #pragma omp master
     {
-        
-        for (i = 1; i < g->num_choice; i++) {
-            g->choice_probs[i] += g->choice_probs[i - 1];
+        for (num = 0; num < g->grow; num++) {
+            breach = rng_next(rng) * sampler_total(sampler);
+            choice = sampler_draw(sampler, breach);
+            // only cells of weight 0 are left to draw
+            if (choice == -1 || (num > 0 && sampler->weight[choice] <= 0.0))
+                break;
+            next_bolts[num] = g->choice_idxs[choice];
+            if (g->grow > 1)
+                exclude_choice(g, next_bolts[num]);
         }
-        breach = (double)rand()/RAND_MAX * g->choice_probs[g->num_choice - 1];
-        choice = locate_value(breach, g->choice_probs, g->num_choice); 
-        if (choice == -1)
-            *choice_point = -1;
-        *choice_point = g->choice_idxs[choice];
+        *num_point = num;
     }
     #pragma omp barrier
 }
 
-static void simulate_one(graph_t *g, int *g_power, int *g_num_choice) {
+// turn the drawn cell idx into bolt
+static void grow_bolt(graph_t *g, idx_t idx, int *power) {
+    if (g->bolt[idx] < 0) {
+        *power += g->bolt[idx];
+        discharge(g, idx, -g->bolt[idx]);
+    }
+    g->bolt[idx] = 1;
+    if (g->dirichlet != NULL)
+        g->dirichlet[idx] = dirichlet_value(1);
+    wake_cell(g, idx);
+    remove_choice(g, idx);
+    find_choice(g, idx);
+    if (g->solver == SOLVER_LOCAL)
+        mark_changed(g, idx);
+}
+
+static void simulate_one(graph_t *g, long lightning, int *g_power, int *g_num_choice) {
+    long step = 0;
+    rng_t rng;
 
-    int idx;
-    
     #pragma omp master
     {
         START_ACTIVITY(ACTIVITY_RECOVER);
-        reset_bolt(g);
-        reset_path(g);
+        reset_touched(g);
         reset_choice(g);
         FINISH_ACTIVITY(ACTIVITY_RECOVER);
     }
     #pragma omp barrier
     while (*g_power > 0) {
-        update_charge(g);
-        int next_bolt = -1;
+        solve_charge(g, 1);
+        int num_next = 0;
+        int k;
         #pragma omp master
         {
             START_ACTIVITY(ACTIVITY_NEXT);
+            rng_init(&rng, g->rng_seed, lightning, step++);
         }
-        find_next(g, &next_bolt);
+        find_next(g, &num_next, &rng);
 
         #pragma omp master
         {
-            // printf("next_bolt: %d\n", next_bolt);   
-            if (next_bolt != -1) {
-                if (g->bolt[next_bolt] < 0) {
-                    *g_power += g->bolt[next_bolt];
-                    discharge(g, next_bolt, -g->bolt[next_bolt]);
-                }
-                g->bolt[next_bolt] = 1;
-                find_choice(g, next_bolt);
+            // the cells stop growing once a ground took the last power
+            for (k = 0; k < num_next && *g_power > 0; k++) {
+                grow_bolt(g, next_bolts[k], g_power);
             }
             FINISH_ACTIVITY(ACTIVITY_NEXT);
 
@@ -231,50 +799,77 @@ static void simulate_one(graph_t *g, int *g_power, int *g_num_choice) {
     {
         START_ACTIVITY(ACTIVITY_RECOVER);
         // one lightning is generated
-        for (idx = 0; idx < g->height * g->width; idx++) {
-            if (g->bolt[idx] > 1) {
-                g->boundary[idx] = g->bolt[idx] * 0.0001;
-            } else {
-                g->boundary[idx] = 0;
-            }
-        }
+        update_boundary(g);
         FINISH_ACTIVITY(ACTIVITY_RECOVER);
     }
     #pragma omp barrier
 }
 
 void simulate(graph_t *g, int count, FILE *ofile) {
+    writer_t *writer;
     int g_power;
     int g_num_choice;
 
     // init graph
     START_ACTIVITY(ACTIVITY_STARTUP);
+    stencil_init();
+    sampler = new_sampler();
+    next_bolts = (idx_t*)malloc(g->grow * sizeof(idx_t));
+    prob_pow = prob_kernel(g->eta);
     reset_bolt(g);
     reset_charge(g);
     reset_boundary(g);
+    if (g->solver == SOLVER_MG) {
+        mg = new_multigrid(g);
+    }
+    // prints a frame while the threads simulate the next
+    writer = new_writer(g, ofile);
     FINISH_ACTIVITY(ACTIVITY_STARTUP);
 
     #pragma omp parallel
     {
         int i;
-        for (i = 0; i < g->width + g->height; i++) {
-            update_charge(g);
+        if (g->solver == SOLVER_MG) {
+            #pragma omp master
+            {
+                START_ACTIVITY(ACTIVITY_UPDATE);
+            }
+            mg_fmg(mg, g);
+            #pragma omp master
+            {
+                FINISH_ACTIVITY(ACTIVITY_UPDATE);
+            }
+            solve_charge(g, 0);
+        } else {
+            solve_charge(g, g->width + g->height);
         }
         // generate lightnings
         for (i = 0; i < count; i++) {
             g_power = g->power;
-            simulate_one(g, &g_power, &g_num_choice);
+            simulate_one(g, i, &g_power, &g_num_choice);
             #pragma omp barrier
             #pragma omp master
             {
                 // print bolt
                 START_ACTIVITY(ACTIVITY_PRINT);
-                print_graph(g, ofile);
-                fprintf(ofile, "\n");
+                writer_put(writer, g);
                 FINISH_ACTIVITY(ACTIVITY_PRINT);
 
             }
             #pragma omp barrier
         }
     }
+    START_ACTIVITY(ACTIVITY_PRINT);
+    free_writer(writer);
+    FINISH_ACTIVITY(ACTIVITY_PRINT);
+
+    if (mg != NULL) {
+        free_multigrid(mg);
+        mg = NULL;
+    }
+    free_tiles();
+    free_sampler(sampler);
+    sampler = NULL;
+    free(next_bolts);
+    next_bolts = NULL;
 }
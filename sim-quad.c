@@ -0,0 +1,253 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "graph.h"
+#include "sim.h"
+#include "quadtree.h"
+#include "sampler.h"
+#include "prob.h"
+#include "rng.h"
+#include "instrument.h"
+
+/*
+ Lightning on the adaptive quadtree mesh, the steps of sim-seq with the
+ per cell arrays replaced by the cell table and the leaves of the mesh.
+ Every lightning rebuilds the mesh around the reset bolts and the
+ charged cells of the last one, the growing bolt refines it further.
+*/
+
+/* Max sweeps of a solve with a residual target */
+#define MAX_SWEEPS 100000
+/* Sweeps of the first solve without a residual target, the graded mesh
+   is a few dozen leaves across however large the graph is */
+#define INIT_SWEEPS 256
+/* SOR factor when -w is not given */
+#define DEFAULT_OMEGA 1.5
+
+// cells next to the bolt, they are single cell leaves, a cell leaves
+// with a swap with the last one when it becomes bolt
+static struct {
+    int num, max;
+    long *key;
+    int *leaf;
+    double *probs;
+} choice = {0, 0, NULL, NULL, NULL};
+// reset bolts (> 0) in row order, the frontier starts around them
+static struct {
+    int num;
+    long *key;
+} seed = {0, NULL};
+/* Draws the next bolt among the choices */
+static sampler_t *sampler = NULL;
+/* charge^eta of the choices, picked for the eta of the graph */
+static prob_kernel_t prob_pow = NULL;
+
+static void choose_helper(quadtree_t *qt, long bolt_key, int i, int j) {
+    qt_cell_t *c;
+    if (i < 0 || i >= qt->height || j < 0 || j >= qt->width)
+        return;
+    c = qt_cell(qt, i, j, 1);
+    if (c->choice == -1 && c->bolt <= 0) {
+        c->choice = choice.num;
+        c->path = bolt_key;
+        if (choice.num == choice.max) {
+            choice.max = choice.max > 0 ? 2 * choice.max : 1024;
+            choice.key = (long*)realloc(choice.key, choice.max * sizeof(long));
+            choice.leaf = (int*)realloc(choice.leaf, choice.max * sizeof(int));
+            choice.probs = (double*)realloc(choice.probs, choice.max * sizeof(double));
+        }
+        choice.key[choice.num] = c->key;
+        choice.leaf[choice.num] = qt_leaf(qt, i, j);
+        choice.num++;
+    }
+}
+
+static void find_choice(quadtree_t *qt, long key) {
+    int i = key / qt->width;
+    int j = key % qt->width;
+    if (qt_cell(qt, i, j, 0)->bolt > 0) {
+        choose_helper(qt, key, i - 1, j);
+        choose_helper(qt, key, i, j - 1);
+        choose_helper(qt, key, i, j + 1);
+        choose_helper(qt, key, i + 1, j);
+    }
+}
+
+static int compare_key(const void *a, const void *b) {
+    long ka = *(const long*)a;
+    long kb = *(const long*)b;
+    return ka < kb ? -1 : ka > kb;
+}
+
+// drop the cell that became bolt, the last choice takes its slot
+static void remove_choice(quadtree_t *qt, long key) {
+    qt_cell_t *c = qt_cell(qt, key / qt->width, key % qt->width, 0);
+    int slot = c->choice;
+    int last = --choice.num;
+    c->choice = -1;
+    if (slot == last)
+        return;
+    choice.key[slot] = choice.key[last];
+    choice.leaf[slot] = choice.leaf[last];
+    qt_cell(qt, choice.key[slot] / qt->width, choice.key[slot] % qt->width, 0)->choice = slot;
+}
+
+// qt_reset cleared the choice slots of the cells
+static void reset_choice(quadtree_t *qt) {
+    int k;
+    choice.num = 0;
+    // get choices idxs around the reset bolts
+    for (k = 0; k < seed.num; k++) {
+        find_choice(qt, seed.key[k]);
+    }
+}
+
+static void find_seeds(graph_points_t *p) {
+    int i;
+    seed.key = (long*)malloc((p->num_point + 1) * sizeof(long));
+    seed.num = 0;
+    for (i = 0; i < p->num_point; i++) {
+        if (p->bolt[i] > 0)
+            seed.key[seed.num++] = (long)p->row[i] * p->width + p->col[i];
+    }
+    // in row order like the dense backends
+    qsort(seed.key, seed.num, sizeof(long), compare_key);
+}
+
+static void solve_charge(quadtree_t *qt, int sweeps, double omega, double tol) {
+    int i;
+    if (tol <= 0.0) {
+        for (i = 0; i < sweeps; i++) {
+            START_ACTIVITY(ACTIVITY_UPDATE);
+            qt_relax(qt, omega);
+            FINISH_ACTIVITY(ACTIVITY_UPDATE);
+        }
+        return;
+    }
+    for (i = 0; i < MAX_SWEEPS; i++) {
+        double residual;
+        START_ACTIVITY(ACTIVITY_UPDATE);
+        residual = qt_relax(qt, omega);
+        FINISH_ACTIVITY(ACTIVITY_UPDATE);
+        if (residual <= tol)
+            break;
+    }
+}
+
+// add charge to bolt along the path
+static void discharge(quadtree_t *qt, long key, int charge) {
+    int count = 500;
+    while (key != -1 && count > 0) {
+        qt_cell_t *c = qt_cell(qt, key / qt->width, key % qt->width, 0);
+        count -= 1;
+        c->bolt += charge;
+        key = c->path;
+    }
+}
+
+static long find_next(quadtree_t *qt, double eta, rng_t *rng) {
+    double breach;
+    int k, choosen;
+
+    // calculate probability based on latest charge
+    if (prob_needs_charge(eta)) {
+        for (k = 0; k < choice.num; k++) {
+            choice.probs[k] = qt->u[choice.leaf[k]];
+        }
+    }
+    prob_pow(choice.probs, choice.num, eta);
+
+    // choose one as bolt
+    sampler_build(sampler, choice.probs, choice.num);
+    breach = rng_next(rng) * sampler_total(sampler);
+    choosen = sampler_draw(sampler, breach);
+
+    if (choosen == -1)
+        return -1;
+    return choice.key[choosen];
+}
+
+static void simulate_one(quadtree_t *qt, int power, double eta, double omega, double tol,
+                         unsigned long rng_seed, long lightning) {
+    long next_bolt;
+    long step = 0;
+    rng_t rng;
+    int k;
+
+    START_ACTIVITY(ACTIVITY_RECOVER);
+    qt_reset(qt);
+    reset_choice(qt);
+    FINISH_ACTIVITY(ACTIVITY_RECOVER);
+
+    while (power > 0) {
+        solve_charge(qt, 1, omega, tol);
+
+        START_ACTIVITY(ACTIVITY_NEXT);
+        rng_init(&rng, rng_seed, lightning, step++);
+        next_bolt = find_next(qt, eta, &rng);
+        if (next_bolt != -1) {
+            int i = next_bolt / qt->width;
+            int j = next_bolt % qt->width;
+            qt_cell_t *c = qt_cell(qt, i, j, 0);
+            if (c->bolt < 0) {
+                power += c->bolt;
+                discharge(qt, next_bolt, -c->bolt);
+            }
+            qt_set_bolt(qt, i, j, 1);
+            remove_choice(qt, next_bolt);
+            find_choice(qt, next_bolt);
+        }
+        FINISH_ACTIVITY(ACTIVITY_NEXT);
+    }
+
+    // one lightning is generated, its channel charges the next one
+    START_ACTIVITY(ACTIVITY_RECOVER);
+    for (k = 0; k < qt->max_cell; k++) {
+        qt_cell_t *c = &qt->cell[k];
+        if (c->key != -1)
+            c->source = c->bolt > 1 ? c->bolt * 0.0001 : 0.0;
+    }
+    FINISH_ACTIVITY(ACTIVITY_RECOVER);
+}
+
+void simulate_quad(graph_points_t *p, int count, unsigned long rng_seed, double omega, double tol,
+                   format_t format, FILE *ofile) {
+    quadtree_t *qt = new_quadtree(p->width, p->height);
+    int i;
+
+    // init graph
+    sampler = new_sampler();
+    prob_pow = prob_kernel(p->eta);
+    find_seeds(p);
+    for (i = 0; i < p->num_point; i++) {
+        qt_cell(qt, p->row[i], p->col[i], 1)->reset_bolt = p->bolt[i];
+    }
+    if (omega <= 0.0)
+        omega = DEFAULT_OMEGA;
+    qt_reset(qt);
+    solve_charge(qt, INIT_SWEEPS, omega, tol);
+
+    // generate lightnings
+    for (i = 0; i < count; i++) {
+        simulate_one(qt, p->power, p->eta, omega, tol, rng_seed, i);
+
+        START_ACTIVITY(ACTIVITY_PRINT);
+        // rasterize the bolt
+        qt_print(qt, format, ofile);
+        FINISH_ACTIVITY(ACTIVITY_PRINT);
+    }
+
+    free_quadtree(qt);
+    free_sampler(sampler);
+    sampler = NULL;
+    free(choice.key);
+    free(choice.leaf);
+    free(choice.probs);
+    choice.key = NULL;
+    choice.leaf = NULL;
+    choice.probs = NULL;
+    choice.num = choice.max = 0;
+    free(seed.key);
+    seed.key = NULL;
+    seed.num = 0;
+}
@@ -3,4 +3,7 @@
 #include <stdio.h>
 #include "graph.h"
 void simulate(graph_t *g, int count, FILE *ofile);
+// light-seq -S quad, reads no graph_t
+void simulate_quad(graph_points_t *p, int count, unsigned long rng_seed, double omega, double tol,
+                   format_t format, FILE *ofile);
 #endif
\ No newline at end of file
@@ -0,0 +1,235 @@
+#include <math.h>
+#include <stddef.h>
+#include "stencil.h"
+
+// the vector kernels are x86 only, elsewhere only the scalar one exists
+#if defined(__x86_64__) || defined(__i386__)
+#define STENCIL_X86 1
+#include <immintrin.h>
+#endif
+
+stencil_row_t stencil_row = NULL;
+
+static const char *isa_name[STENCIL_COUNT] = { "scalar", "avx2", "avx512" };
+
+/*
+ Vector types of the kernels for the field precision.
+ Mixed precision loads float lanes into double registers and rounds
+ back on store, the arithmetic is the same as in double.
+*/
+#if STENCIL_X86
+#if FLOAT_FIELD == 2
+#define V2_LANES 8
+#define V2_T __m256
+#define V2_LOAD(p) _mm256_loadu_ps(p)
+#define V2_STORE(p, v) _mm256_storeu_ps(p, v)
+#define V2_SET1(x) _mm256_set1_ps(x)
+#define V2_ADD(a, b) _mm256_add_ps(a, b)
+#define V2_SUB(a, b) _mm256_sub_ps(a, b)
+#define V2_MUL(a, b) _mm256_mul_ps(a, b)
+#define V2_MAX(a, b) _mm256_max_ps(a, b)
+#define V2_AND(a, b) _mm256_and_ps(a, b)
+#define V2_ANDNOT(a, b) _mm256_andnot_ps(a, b)
+#define V2_LT(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define V2_BLEND(a, b, m) _mm256_blendv_ps(a, b, m)
+#define V2_STORE_ACC(p, v) _mm256_storeu_ps(p, v)
+#define V5_LANES 16
+#define V5_T __m512
+#define V5_MASK __mmask16
+#define V5_LOAD(p) _mm512_loadu_ps(p)
+#define V5_STORE(p, v) _mm512_storeu_ps(p, v)
+#define V5_SET1(x) _mm512_set1_ps(x)
+#define V5_ADD(a, b) _mm512_add_ps(a, b)
+#define V5_SUB(a, b) _mm512_sub_ps(a, b)
+#define V5_MUL(a, b) _mm512_mul_ps(a, b)
+#define V5_ABS(a) _mm512_abs_ps(a)
+#define V5_MASK_MAX(s, m, a, b) _mm512_mask_max_ps(s, m, a, b)
+#define V5_LT(a, b) _mm512_cmp_ps_mask(a, b, _CMP_LT_OQ)
+#define V5_BLEND(m, a, b) _mm512_mask_blend_ps(m, a, b)
+#define V5_REDUCE_MAX(v) _mm512_reduce_max_ps(v)
+#else
+#define V2_LANES 4
+#define V2_T __m256d
+#if FLOAT_FIELD
+#define V2_LOAD(p) _mm256_cvtps_pd(_mm_loadu_ps(p))
+#define V2_STORE(p, v) _mm_storeu_ps(p, _mm256_cvtpd_ps(v))
+#else
+#define V2_LOAD(p) _mm256_loadu_pd(p)
+#define V2_STORE(p, v) _mm256_storeu_pd(p, v)
+#endif
+#define V2_SET1(x) _mm256_set1_pd(x)
+#define V2_ADD(a, b) _mm256_add_pd(a, b)
+#define V2_SUB(a, b) _mm256_sub_pd(a, b)
+#define V2_MUL(a, b) _mm256_mul_pd(a, b)
+#define V2_MAX(a, b) _mm256_max_pd(a, b)
+#define V2_AND(a, b) _mm256_and_pd(a, b)
+#define V2_ANDNOT(a, b) _mm256_andnot_pd(a, b)
+#define V2_LT(a, b) _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+#define V2_BLEND(a, b, m) _mm256_blendv_pd(a, b, m)
+#define V2_STORE_ACC(p, v) _mm256_storeu_pd(p, v)
+#define V5_LANES 8
+#define V5_T __m512d
+#define V5_MASK __mmask8
+#if FLOAT_FIELD
+#define V5_LOAD(p) _mm512_cvtps_pd(_mm256_loadu_ps(p))
+#define V5_STORE(p, v) _mm256_storeu_ps(p, _mm512_cvtpd_ps(v))
+#else
+#define V5_LOAD(p) _mm512_loadu_pd(p)
+#define V5_STORE(p, v) _mm512_storeu_pd(p, v)
+#endif
+#define V5_SET1(x) _mm512_set1_pd(x)
+#define V5_ADD(a, b) _mm512_add_pd(a, b)
+#define V5_SUB(a, b) _mm512_sub_pd(a, b)
+#define V5_MUL(a, b) _mm512_mul_pd(a, b)
+#define V5_ABS(a) _mm512_abs_pd(a)
+#define V5_MASK_MAX(s, m, a, b) _mm512_mask_max_pd(s, m, a, b)
+#define V5_LT(a, b) _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ)
+#define V5_BLEND(m, a, b) _mm512_mask_blend_pd(m, a, b)
+#define V5_REDUCE_MAX(v) _mm512_reduce_max_pd(v)
+#endif
+#endif
+
+// one cell, same order of additions as the vector kernels
+static inline double stencil_cell(const real_t *up, const real_t *mid, const real_t *down,
+                                  const real_t *boundary, const real_t *dirichlet, real_t *out,
+                                  int j, real_t left, real_t right) {
+    acc_t sum;
+    if (dirichlet[j] >= 0) {
+        out[j] = dirichlet[j];
+        return 0.0;
+    }
+    sum = (acc_t)boundary[j] + up[j];
+    sum += down[j];
+    sum += left;
+    sum += right;
+    out[j] = sum * (acc_t)0.25;
+    return fabs((acc_t)out[j] - (acc_t)mid[j]);
+}
+
+// first and last cell of the row, their outer neighbors are passed in
+// returns the delta, the caller does the cells [1, n - 1)
+static inline double stencil_edges(const real_t *up, const real_t *mid, const real_t *down,
+                                   const real_t *boundary, const real_t *dirichlet, real_t *out,
+                                   int n, real_t left, real_t right) {
+    if (n == 1)
+        return stencil_cell(up, mid, down, boundary, dirichlet, out, 0, left, right);
+    return fmax(stencil_cell(up, mid, down, boundary, dirichlet, out, 0, left, mid[1]),
+                stencil_cell(up, mid, down, boundary, dirichlet, out, n - 1, mid[n - 2], right));
+}
+
+static double stencil_row_scalar(const real_t *up, const real_t *mid, const real_t *down,
+                                 const real_t *boundary, const real_t *dirichlet, real_t *out,
+                                 int n, real_t left, real_t right) {
+    int j;
+    int end = n - 1;
+    double delta = stencil_edges(up, mid, down, boundary, dirichlet, out, n, left, right);
+    for (j = 1; j < end; j++) {
+        delta = fmax(delta, stencil_cell(up, mid, down, boundary, dirichlet, out, j, mid[j - 1], mid[j + 1]));
+    }
+    return delta;
+}
+
+#if STENCIL_X86
+__attribute__((target("avx2")))
+static double stencil_row_avx2(const real_t *up, const real_t *mid, const real_t *down,
+                               const real_t *boundary, const real_t *dirichlet, real_t *out,
+                               int n, real_t left, real_t right) {
+    int j, k;
+    int end = n - 1;
+    double delta = stencil_edges(up, mid, down, boundary, dirichlet, out, n, left, right);
+    const V2_T quarter = V2_SET1(0.25);
+    const V2_T zero = V2_SET1(0.0);
+    const V2_T sign = V2_SET1(-0.0);
+    V2_T vdelta = zero;
+    acc_t lanes[V2_LANES];
+
+    for (j = 1; j + V2_LANES <= end; j += V2_LANES) {
+        V2_T sum = V2_ADD(V2_LOAD(boundary + j), V2_LOAD(up + j));
+        V2_T fixed = V2_LOAD(dirichlet + j);
+        V2_T old = V2_LOAD(mid + j);
+        V2_T free_mask = V2_LT(fixed, zero);
+        V2_T res;
+        sum = V2_ADD(sum, V2_LOAD(down + j));
+        sum = V2_ADD(sum, V2_LOAD(mid + j - 1));
+        sum = V2_ADD(sum, V2_LOAD(mid + j + 1));
+        sum = V2_MUL(sum, quarter);
+        res = V2_BLEND(fixed, sum, free_mask);
+        V2_STORE(out + j, res);
+        // |new - old| of the free cells
+        res = V2_ANDNOT(sign, V2_SUB(res, old));
+        vdelta = V2_MAX(vdelta, V2_AND(res, free_mask));
+    }
+    V2_STORE_ACC(lanes, vdelta);
+    for (k = 0; k < V2_LANES; k++) {
+        delta = fmax(delta, lanes[k]);
+    }
+    for (; j < end; j++) {
+        delta = fmax(delta, stencil_cell(up, mid, down, boundary, dirichlet, out, j, mid[j - 1], mid[j + 1]));
+    }
+    return delta;
+}
+
+__attribute__((target("avx512f")))
+static double stencil_row_avx512(const real_t *up, const real_t *mid, const real_t *down,
+                                 const real_t *boundary, const real_t *dirichlet, real_t *out,
+                                 int n, real_t left, real_t right) {
+    int j;
+    int end = n - 1;
+    double delta = stencil_edges(up, mid, down, boundary, dirichlet, out, n, left, right);
+    const V5_T quarter = V5_SET1(0.25);
+    const V5_T zero = V5_SET1(0.0);
+    V5_T vdelta = zero;
+
+    for (j = 1; j + V5_LANES <= end; j += V5_LANES) {
+        V5_T sum = V5_ADD(V5_LOAD(boundary + j), V5_LOAD(up + j));
+        V5_T fixed = V5_LOAD(dirichlet + j);
+        V5_T old = V5_LOAD(mid + j);
+        V5_MASK free_mask = V5_LT(fixed, zero);
+        V5_T res;
+        sum = V5_ADD(sum, V5_LOAD(down + j));
+        sum = V5_ADD(sum, V5_LOAD(mid + j - 1));
+        sum = V5_ADD(sum, V5_LOAD(mid + j + 1));
+        sum = V5_MUL(sum, quarter);
+        res = V5_BLEND(free_mask, fixed, sum);
+        V5_STORE(out + j, res);
+        // |new - old| of the free cells
+        res = V5_ABS(V5_SUB(res, old));
+        vdelta = V5_MASK_MAX(vdelta, free_mask, vdelta, res);
+    }
+    delta = fmax(delta, V5_REDUCE_MAX(vdelta));
+    for (; j < end; j++) {
+        delta = fmax(delta, stencil_cell(up, mid, down, boundary, dirichlet, out, j, mid[j - 1], mid[j + 1]));
+    }
+    return delta;
+}
+#endif
+
+stencil_row_t stencil_kernel(stencil_isa_t isa) {
+#if STENCIL_X86
+    __builtin_cpu_init();
+    switch (isa) {
+    case STENCIL_AVX512:
+        return __builtin_cpu_supports("avx512f") ? stencil_row_avx512 : NULL;
+    case STENCIL_AVX2:
+        return __builtin_cpu_supports("avx2") ? stencil_row_avx2 : NULL;
+    default:
+        return stencil_row_scalar;
+    }
+#else
+    return isa == STENCIL_SCALAR ? stencil_row_scalar : NULL;
+#endif
+}
+
+const char *stencil_name(stencil_isa_t isa) {
+    return isa_name[isa];
+}
+
+// pick the widest kernel this cpu runs
+void stencil_init(void) {
+    int isa;
+    for (isa = STENCIL_COUNT - 1; isa >= 0; isa--) {
+        stencil_row = stencil_kernel((stencil_isa_t)isa);
+        if (stencil_row != NULL)
+            return;
+    }
+}
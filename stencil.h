@@ -0,0 +1,40 @@
+#ifndef __STENCIL_H__
+#define __STENCIL_H__
+#include "graph.h"
+
+/*
+ Row kernels of the jacobi update.
+ For the n cells of a row:
+   out[j] = dirichlet[j] if dirichlet[j] >= 0 (bolt cell)
+   out[j] = (boundary[j] + up[j] + down[j] + mid[j - 1] + mid[j + 1]) / 4 otherwise
+ where mid[-1] is left and mid[n] is right.
+ up and down are the ghost rows of zeros at the top and bottom of the
+ field. mid[-1] and mid[n] are never read, left / right are the charge
+ of the neighbors of cell 0 / n - 1 (0 at the graph edge), so a row may
+ be a piece of a tile.
+ Returns the max |out - mid| over the free cells.
+*/
+
+typedef double (*stencil_row_t)(const real_t *up, const real_t *mid, const real_t *down,
+                                const real_t *boundary, const real_t *dirichlet, real_t *out,
+                                int n, real_t left, real_t right);
+
+/* Kernel picked by stencil_init */
+extern stencil_row_t stencil_row;
+
+typedef enum { STENCIL_SCALAR, STENCIL_AVX2, STENCIL_AVX512, STENCIL_COUNT } stencil_isa_t;
+
+void stencil_init(void);
+stencil_row_t stencil_kernel(stencil_isa_t isa);
+const char *stencil_name(stencil_isa_t isa);
+
+// dirichlet value of a cell, negative for free cells
+static inline real_t dirichlet_value(int bolt) {
+    if (bolt < 0)
+        return 1.0;
+    if (bolt > 0)
+        return 0.0;
+    return -1.0;
+}
+
+#endif
@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <string.h>
+#include "writer.h"
+
+static void *write_frames(void *arg) {
+    writer_t *w = (writer_t*)arg;
+    pthread_mutex_lock(&w->lock);
+    while (1) {
+        while (w->full == 0 && !w->done)
+            pthread_cond_wait(&w->changed, &w->lock);
+        if (w->full == 0)
+            break;
+        // the snapshot at head is only written by writer_put once freed
+        pthread_mutex_unlock(&w->lock);
+        w->view.bolt = w->slot[w->head];
+        print_frame(&w->view, w->outfile);
+        pthread_mutex_lock(&w->lock);
+        w->head = (w->head + 1) % WRITER_SLOTS;
+        w->full--;
+        pthread_cond_broadcast(&w->changed);
+    }
+    pthread_mutex_unlock(&w->lock);
+    fflush(w->outfile);
+    return NULL;
+}
+
+writer_t *new_writer(graph_t *g, FILE *outfile) {
+    writer_t *w = (writer_t*)calloc(1, sizeof(writer_t));
+    size_t bytes = (size_t)graph_cells(g) * sizeof(bolt_t);
+    int k;
+    w->view = *g;
+    w->outfile = outfile;
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->changed, NULL);
+    // in files of -D as well if the graph is
+    w->arena = new_arena(WRITER_SLOTS * arena_span(bytes));
+    if (w->arena == NULL) {
+        w->sync = 1;
+        return w;
+    }
+    for (k = 0; k < WRITER_SLOTS; k++) {
+        w->slot[k] = (bolt_t*)arena_alloc(w->arena, bytes);
+    }
+    w->sync = pthread_create(&w->thread, NULL, write_frames, w) != 0;
+    return w;
+}
+
+void writer_put(writer_t *w, graph_t *g) {
+    size_t bytes = (size_t)graph_cells(g) * sizeof(bolt_t);
+    int k;
+    if (w->sync) {
+        print_frame(g, w->outfile);
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    while (w->full == WRITER_SLOTS)
+        pthread_cond_wait(&w->changed, &w->lock);
+    k = (w->head + w->full) % WRITER_SLOTS;
+    pthread_mutex_unlock(&w->lock);
+    memcpy(w->slot[k], g->bolt, bytes);
+    pthread_mutex_lock(&w->lock);
+    w->full++;
+    pthread_cond_broadcast(&w->changed);
+    pthread_mutex_unlock(&w->lock);
+}
+
+void free_writer(writer_t *w) {
+    if (!w->sync) {
+        pthread_mutex_lock(&w->lock);
+        w->done = 1;
+        pthread_cond_broadcast(&w->changed);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+    }
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->changed);
+    free_arena(w->arena);
+    free(w);
+}
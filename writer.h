@@ -0,0 +1,39 @@
+#ifndef __WRITER_H__
+#define __WRITER_H__
+#include <stdio.h>
+#include <pthread.h>
+#include "graph.h"
+
+/*
+ Writes the frames of a simulation on a thread of its own, so
+ formatting and output overlap with the next lightning.
+ writer_put copies the bolt into one of WRITER_SLOTS snapshots and
+ returns, the thread prints the snapshots in order with print_frame.
+ When every snapshot waits for the disk writer_put blocks, so the
+ frames in flight never take more than WRITER_SLOTS copies of bolt.
+*/
+
+#define WRITER_SLOTS 2
+
+typedef struct {
+    graph_t view; // the graph with bolt pointing at the snapshot printed
+    FILE *outfile;
+    arena_t *arena; // the snapshots
+    bolt_t *slot[WRITER_SLOTS];
+    int head; // next snapshot to print
+    int full; // snapshots waiting to be printed
+    int done;
+    int sync; // no thread, writer_put prints
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    pthread_t thread;
+} writer_t;
+
+// frames of g to outfile, until free_writer returns only the thread
+// of the writer touches outfile
+writer_t *new_writer(graph_t *g, FILE *outfile);
+void writer_put(writer_t *w, graph_t *g);
+// prints the frames left and stops the thread
+void free_writer(writer_t *w);
+
+#endif